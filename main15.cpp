@@ -4,184 +4,5126 @@
 #include <string>
 #include <memory>
 #include <map>
+#include <list>
+#include <unordered_map>
 #include <functional>
 #include <cstdint>
+#include <chrono>
+#include <cmath>
+#include <coroutine>
+#include <exception>
+#include <limits>
+#include <sstream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <queue>
+#include <random>
+#include <charconv>
+#include <cstring>
+#include <cstddef>
+#include <string_view>
+#include <span>
+#include <optional>
+#include <utility>
+#include <csignal>
+#include <cctype>
+#include <glob.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+// io_uring reads for --read-ahead are opt-in, since they need liburing at link
+// time: g++ -std=c++20 -DUSE_LIBURING main15.cpp -luring
+#ifdef USE_LIBURING
+#include <liburing.h>
+#define HAVE_LIBURING 1
+#endif
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Per-stage work time and counters. Stages add to them once per batch, so the
+// overhead stays negligible and it is safe to update from several threads.
+struct PipelineStats {
+    std::atomic<uint64_t> read_ns{ 0 };
+    std::atomic<uint64_t> parse_ns{ 0 };
+    std::atomic<uint64_t> filter_ns{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+    std::atomic<uint64_t> numbers_in{ 0 };
+    std::atomic<uint64_t> numbers_out{ 0 };
+    std::deque<std::atomic<uint64_t>> observer_ns;
+    std::vector<std::string> observer_names;
+    uint64_t wall_ns = 0;
+    size_t queries = 1;
+
+    void add_observer(const std::string& name) {
+        observer_names.push_back(name);
+        observer_ns.emplace_back(0);
+    }
+
+    // Averaged over queries when several share one scan.
+    double selectivity() const {
+        return numbers_in ? double(numbers_out) / (double(numbers_in) * queries) : 0.0;
+    }
+
+    void print_summary(std::ostream& out) const {
+        auto ms = [](uint64_t ns) { return ns / 1e6; };
+        out << "Stats: wall " << ms(wall_ns) << " ms, read " << ms(read_ns) << " ms, parse "
+            << ms(parse_ns) << " ms, filter " << ms(filter_ns) << " ms\n";
+        for (size_t i = 0; i < observer_names.size(); ++i) {
+            out << "Stats: observer " << observer_names[i] << " " << ms(observer_ns[i]) << " ms\n";
+        }
+        out << "Stats: " << bytes << " bytes, " << numbers_in << " numbers in, " << numbers_out
+            << " passed, selectivity " << selectivity() << "\n";
+    }
+
+    std::string to_json() const {
+        std::ostringstream json;
+        json << "{ \"wall_ns\": " << wall_ns << ", \"read_ns\": " << read_ns
+            << ", \"parse_ns\": " << parse_ns << ", \"filter_ns\": " << filter_ns
+            << ", \"bytes\": " << bytes << ", \"numbers_in\": " << numbers_in
+            << ", \"numbers_out\": " << numbers_out << ", \"selectivity\": " << selectivity()
+            << ", \"observers\": [";
+        for (size_t i = 0; i < observer_names.size(); ++i) {
+            json << (i ? ", " : "") << "{ \"name\": \"" << observer_names[i]
+                << "\", \"ns\": " << observer_ns[i] << " }";
+        }
+        json << "] }\n";
+        return json.str();
+    }
+};
+
+class StageTimer {
+    std::atomic<uint64_t>* target;
+    uint64_t start;
+
+public:
+    explicit StageTimer(std::atomic<uint64_t>* target)
+        : target(target), start(target ? now_ns() : 0) {
+    }
+
+    ~StageTimer() {
+        if (target) target->fetch_add(now_ns() - start, std::memory_order_relaxed);
+    }
+};
+
+std::atomic<uint64_t>* stat(PipelineStats* stats, std::atomic<uint64_t> PipelineStats::* field) {
+    return stats ? &(stats->*field) : nullptr;
+}
 
 struct INumberReader {
+    using BatchSink = std::function<void(const std::vector<int>&)>;
+
     virtual ~INumberReader() = default;
-    virtual std::vector<int> read_numbers(const std::string& filename) = 0;
+    // Readers deliver numbers in batches; read_numbers collects them all.
+    virtual void read_batches(const std::string& filename, const BatchSink& sink) = 0;
+    virtual std::vector<int> read_numbers(const std::string& filename) {
+        std::vector<int> numbers;
+        read_batches(filename, [&](const std::vector<int>& batch) {
+            numbers.insert(numbers.end(), batch.begin(), batch.end());
+            });
+        return numbers;
+    }
+    virtual bool splittable(const std::string&) const { return false; }
+    virtual bool reads_text(const std::string&) const { return false; }
+
+    void set_stats(PipelineStats* s) {
+        stats = s;
+    }
+
+    // Readers poll `flag` between batches and stop reading once it is set.
+    void set_cancel(const std::atomic<bool>* flag) {
+        cancel = flag;
+    }
+
+protected:
+    PipelineStats* stats = nullptr;
+    const std::atomic<bool>* cancel = nullptr;
+
+    bool cancelled() const {
+        return cancel && cancel->load(std::memory_order_relaxed);
+    }
 };
 
 struct INumberFilter {
     virtual ~INumberFilter() = default;
     virtual bool keep(int number) = 0;
+    virtual std::unique_ptr<INumberFilter> clone() const = 0;
+
+    // Writes the indices of passing values to `selection` and returns how many
+    // passed. The default is branch-free around the virtual keep() call.
+    virtual size_t select(const int* values, size_t count, uint32_t* selection) {
+        size_t passed = 0;
+        for (size_t i = 0; i < count; ++i) {
+            selection[passed] = static_cast<uint32_t>(i);
+            passed += keep(values[i]);
+        }
+        return passed;
+    }
+};
+
+template <typename Predicate>
+size_t select_branchless(const int* values, size_t count, uint32_t* selection, Predicate pred) {
+    size_t passed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        selection[passed] = static_cast<uint32_t>(i);
+        passed += pred(values[i]);
+    }
+    return passed;
+}
+
+#ifdef __SSE2__
+// Lane offsets of the set bits of every 4-bit mask, so a compare mask turns
+// into selection indices without branches.
+struct LaneTable {
+    alignas(16) uint32_t lanes[16][4] = {};
+    uint8_t counts[16] = {};
+
+    constexpr LaneTable() {
+        for (int mask = 0; mask < 16; ++mask) {
+            for (int lane = 0; lane < 4; ++lane) {
+                if (mask & (1 << lane)) lanes[mask][counts[mask]++] = static_cast<uint32_t>(lane);
+            }
+        }
+    }
 };
 
+inline constexpr LaneTable lane_table;
+
+// Evaluates `vector_pred` four values at a time; it must return all-ones
+// lanes for passing values. Up to three indices past the result are written,
+// which always stays inside `selection` because passed <= i.
+template <typename VectorPredicate, typename Predicate>
+size_t select_simd(const int* values, size_t count, uint32_t* selection, VectorPredicate vector_pred, Predicate pred) {
+    size_t passed = 0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(vector_pred(v)));
+        __m128i lanes = _mm_load_si128(reinterpret_cast<const __m128i*>(lane_table.lanes[mask]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(selection + passed),
+            _mm_add_epi32(lanes, _mm_set1_epi32(static_cast<int>(i))));
+        passed += lane_table.counts[mask];
+    }
+    for (; i < count; ++i) {
+        selection[passed] = static_cast<uint32_t>(i);
+        passed += pred(values[i]);
+    }
+    return passed;
+}
+#endif
+
 struct INumberObserver {
     virtual ~INumberObserver() = default;
     virtual void on_number(int number) = 0;
     virtual void on_finished() = 0;
-};
+    // Observers that can run in several workers return true from forkable()
+    // and a fresh copy from fork(); merge() folds a copy's state back in.
+    virtual bool forkable() const { return false; }
+    virtual std::unique_ptr<INumberObserver> fork() const { return nullptr; }
+    virtual void merge(INumberObserver&) {}
+    virtual void on_progress() {}
+    virtual const char* name() const { return "Observer"; }
 
-class FileNumberReader : public INumberReader {
-public:
-    std::vector<int> read_numbers(const std::string& filename) override {
-        std::ifstream in(filename);
-        if (!in.is_open()) {
-            std::cout << "Error: File not found: " << filename << "\n";
-            return {};
-        }
+    // Returns true once the observer needs no more input. When any copy of any
+    // observer of a query says so, the query stops receiving numbers.
+    virtual bool done() const { return false; }
 
-        std::vector<int> numbers;
-        int n;
-        while (in >> n) {
-            numbers.push_back(n);
+    // False when the result does not depend on the order numbers arrive in,
+    // which lets the processor parse one file in parallel chunks.
+    virtual bool order_sensitive() const { return true; }
+
+    // Observers whose accumulated state can be persisted return true from
+    // saves_state() and implement both. load_state replaces the state with one
+    // written by save_state of an identically configured observer and leaves
+    // it untouched on failure.
+    virtual bool saves_state() const { return false; }
+    virtual bool save_state(std::string&) const { return false; }
+    virtual bool load_state(std::string_view) { return false; }
+
+    virtual void on_batch(const int* values, const uint32_t* selection, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            on_number(values[selection[i]]);
         }
-        return numbers;
     }
 };
 
-class EvenFilter : public INumberFilter {
+// Helpers for observer state blobs: raw native-endian values, read back with
+// bounds checks.
+template <typename T>
+void put_pod(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool get_pod(std::string_view& in, T& value) {
+    if (in.size() < sizeof(value)) return false;
+    std::memcpy(&value, in.data(), sizeof(value));
+    in.remove_prefix(sizeof(value));
+    return true;
+}
+
+// Selection {0, 1, ..., count - 1} for handing dense values to on_batch.
+const uint32_t* identity_selection() {
+    static const auto identity = [] {
+        std::array<uint32_t, 4096> selection;
+        for (uint32_t i = 0; i < selection.size(); ++i) selection[i] = i;
+        return selection;
+    }();
+    return identity.data();
+}
+
+struct ParseResult {
+    size_t consumed;
+    bool stopped;
+};
+
+// Parses whitespace-separated ints the way `in >> n` does: parsing stops at the
+// first malformed token. Unless `last` is set, a token touching `end` is left
+// unconsumed because the next chunk may continue it.
+ParseResult parse_numbers(const char* begin, const char* end, bool last, std::vector<int>& out) {
+    const char* p = begin;
+    while (true) {
+        while (p < end && std::isspace(static_cast<unsigned char>(*p))) ++p;
+        if (p == end) return { size_t(p - begin), false };
+
+        const char* token = p;
+        if (!last) {
+            const char* q = p;
+            while (q < end && !std::isspace(static_cast<unsigned char>(*q))) ++q;
+            if (q == end) return { size_t(token - begin), false };
+        }
+
+        if (*p == '+' && p + 1 < end && p[1] != '-') ++p;
+        int value;
+        auto [ptr, ec] = std::from_chars(p, end, value);
+        if (ec != std::errc()) return { size_t(token - begin), true };
+        out.push_back(value);
+        p = ptr;
+    }
+}
+
+// Feeds arbitrary byte chunks to parse_numbers, stitching tokens that span
+// chunk boundaries.
+class ChunkParser {
+    std::string carry;
+    bool stopped = false;
+
 public:
-    bool keep(int number) override {
-        return number % 2 == 0;
+    bool feed(const char* data, size_t size, std::vector<int>& out) {
+        if (stopped) return false;
+        const char* p = data;
+        const char* end = data + size;
+        if (!carry.empty()) {
+            const char* ws = std::find_if(p, end, [](char c) { return std::isspace(static_cast<unsigned char>(c)); });
+            carry.append(p, ws);
+            if (ws == end) return true;
+            auto result = parse_numbers(carry.data(), carry.data() + carry.size(), true, out);
+            carry.clear();
+            if (result.stopped) return !(stopped = true);
+            p = ws;
+        }
+        auto result = parse_numbers(p, end, false, out);
+        if (result.stopped) return !(stopped = true);
+        carry.assign(p + result.consumed, end);
+        return true;
+    }
+
+    void finish(std::vector<int>& out) {
+        if (!stopped) parse_numbers(carry.data(), carry.data() + carry.size(), true, out);
+        carry.clear();
     }
 };
 
-class OddFilter : public INumberFilter {
+int open_input(const std::string& filename) {
+    if (filename == "-") return STDIN_FILENO;
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "Error: File not found: " << filename << "\n";
+    }
+    return fd;
+}
+
+// Lazy single-pass generator for C++20 coroutines, standing in for C++23's
+// std::generator. The body runs only when the consumer advances the iterator,
+// and destroying the generator early unwinds the suspended frame.
+template <typename T>
+class Generator {
 public:
-    bool keep(int number) override {
-        return number % 2 != 0;
+    struct promise_type {
+        const T* current = nullptr;
+        std::exception_ptr error;
+
+        Generator get_return_object() {
+            return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(const T& value) noexcept {
+            current = std::addressof(value);
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    class iterator {
+        std::coroutine_handle<promise_type> handle;
+
+    public:
+        explicit iterator(std::coroutine_handle<promise_type> h = nullptr) : handle(h) {}
+
+        const T& operator*() const { return *handle.promise().current; }
+        iterator& operator++() {
+            advance(handle);
+            return *this;
+        }
+        bool operator==(std::default_sentinel_t) const { return !handle || handle.done(); }
+    };
+
+    Generator(Generator&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Generator& operator=(Generator&& other) noexcept {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+    ~Generator() {
+        if (handle) handle.destroy();
+    }
+
+    iterator begin() {
+        advance(handle);
+        return iterator(handle);
+    }
+    std::default_sentinel_t end() const { return {}; }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit Generator(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+    static void advance(std::coroutine_handle<promise_type> h) {
+        h.resume();
+        if (h.done() && h.promise().error) std::rethrow_exception(h.promise().error);
     }
 };
 
-class GTFilter : public INumberFilter {
-    int threshold;
+// Yields the raw bytes of a file in small read(2) chunks, so a consumer that
+// stops early leaves the rest of the file unread.
+Generator<std::string_view> lazy_chunks(std::string filename, PipelineStats* stats, size_t chunk_size = 64 << 10) {
+    struct Closer {
+        int fd;
+        ~Closer() {
+            if (fd > STDIN_FILENO) ::close(fd);
+        }
+    } input{ open_input(filename) };
+    if (input.fd < 0) co_return;
+
+    std::vector<char> buffer(chunk_size);
+    while (true) {
+        ssize_t got;
+        {
+            StageTimer timer(stat(stats, &PipelineStats::read_ns));
+            got = ::read(input.fd, buffer.data(), buffer.size());
+        }
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        if (stats) stats->bytes += got;
+        co_yield std::string_view(buffer.data(), got);
+    }
+}
+
+// Parses byte chunks into batches of at most batch_size numbers.
+Generator<std::span<const int>> lazy_parse(Generator<std::string_view> chunks, PipelineStats* stats, size_t batch_size = 4096) {
+    ChunkParser parser;
+    std::vector<int> numbers;
+    for (std::string_view chunk : chunks) {
+        bool more;
+        {
+            StageTimer timer(stat(stats, &PipelineStats::parse_ns));
+            more = parser.feed(chunk.data(), chunk.size(), numbers);
+        }
+        for (size_t i = 0; i < numbers.size(); i += batch_size) {
+            co_yield std::span<const int>(numbers.data() + i, std::min(batch_size, numbers.size() - i));
+        }
+        numbers.clear();
+        if (!more) co_return;
+    }
+    parser.finish(numbers);
+    if (!numbers.empty()) co_yield std::span<const int>(numbers);
+}
+
+class MappedFile {
+    const char* addr = nullptr;
+    size_t length = 0;
+    bool ok = false;
+
 public:
-    GTFilter(int n) : threshold(n) {}
-    bool keep(int number) override {
-        return number > threshold;
+    explicit MappedFile(const std::string& filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cout << "Error: File not found: " << filename << "\n";
+            return;
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) == 0) {
+            length = st.st_size;
+            if (length == 0) {
+                ok = true;
+            }
+            else {
+                void* p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    addr = static_cast<const char*>(p);
+                    ok = true;
+                    ::madvise(p, length, MADV_SEQUENTIAL);
+                }
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (addr) ::munmap(const_cast<char*>(addr), length);
     }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return addr; }
+    size_t size() const { return length; }
+    bool valid() const { return ok; }
 };
 
-class FilterFactory {
-    using Creator = std::function<std::unique_ptr<INumberFilter>(const std::string&)>;
-    std::map<std::string, Creator> registry;
+// Compact binary encodings of a number stream. A file is a 16-byte header
+// followed by the payload; block encodings work on runs of 128 values.
+//   DELTA_VARINT:       zigzag(value - previous) as LEB128 varints
+//   FRAME_OF_REFERENCE: per block int32 minimum, width byte, (value - min) bit-packed
+//   BIT_PACKED:         per block width byte, zigzag(value) bit-packed
+enum class Encoding : uint8_t { DELTA_VARINT = 1, FRAME_OF_REFERENCE = 2, BIT_PACKED = 3 };
+
+struct CompressedHeader {
+    char magic[4] = { 'N', 'P', 'K', '1' };
+    uint8_t encoding = 0;
+    uint8_t reserved[3] = {};
+    uint64_t count = 0;
+};
 
+class CompressedCodec {
 public:
-    static FilterFactory& instance() {
-        static FilterFactory factory;
-        return factory;
+    static constexpr size_t block_size = 128;
+
+    static uint32_t zigzag(int32_t v) {
+        return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
     }
 
-    void register_filter(const std::string& prefix, Creator creator) {
-        registry[prefix] = creator;
+    static unsigned bit_width(uint32_t v) {
+        return v ? 32 - __builtin_clz(v) : 0;
     }
 
-    std::unique_ptr<INumberFilter> create(const std::string& name) {
-        for (const auto& [prefix, creator] : registry) {
-            if (name.starts_with(prefix)) {
-                return creator(name.substr(prefix.size()));
+    static size_t packed_bytes(size_t n, unsigned width) {
+        return (n * width + 7) / 8;
+    }
+
+    static void pack(const uint32_t* in, size_t n, unsigned width, std::string& out) {
+        uint64_t acc = 0;
+        unsigned bits = 0;
+        for (size_t i = 0; i < n; ++i) {
+            acc |= static_cast<uint64_t>(in[i]) << bits;
+            bits += width;
+            while (bits >= 8) {
+                out.push_back(static_cast<char>(acc & 0xff));
+                acc >>= 8;
+                bits -= 8;
             }
         }
+        if (bits > 0) out.push_back(static_cast<char>(acc & 0xff));
+    }
 
-        std::cout << "Error: Unknown filter: " << name << "\n";
-        return nullptr;
+    // Extracts each value from an unaligned 64-bit window; the slow tail path
+    // only runs for the last bytes of the mapping.
+    static void unpack(const uint8_t* in, const uint8_t* end, unsigned width, size_t n, uint32_t* out) {
+        if (width == 0) {
+            std::fill(out, out + n, 0u);
+            return;
+        }
+        uint64_t mask = width == 32 ? 0xffffffffull : (1ull << width) - 1;
+        for (size_t i = 0; i < n; ++i) {
+            size_t bit = i * width;
+            const uint8_t* p = in + bit / 8;
+            uint64_t word = 0;
+            std::memcpy(&word, p, p + 8 <= end ? 8 : end - p);
+            out[i] = static_cast<uint32_t>((word >> (bit % 8)) & mask);
+        }
     }
 
-private:
-    FilterFactory() = default;
-};
+    static void unzigzag(const uint32_t* in, size_t n, int* out) {
+        size_t i = 0;
+#ifdef __SSE2__
+        const __m128i one = _mm_set1_epi32(1);
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            __m128i sign = _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, one));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(_mm_srli_epi32(v, 1), sign));
+        }
+#endif
+        for (; i < n; ++i) {
+            out[i] = static_cast<int>((in[i] >> 1) ^ (0u - (in[i] & 1)));
+        }
+    }
 
-class PrintObserver : public INumberObserver {
-public:
-    void on_number(int number) override {
-        std::cout << "Number passed: " << number << "\n";
+    static void add_base(const uint32_t* in, size_t n, int32_t base, int* out) {
+        size_t i = 0;
+#ifdef __SSE2__
+        const __m128i b = _mm_set1_epi32(base);
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_add_epi32(v, b));
+        }
+#endif
+        for (; i < n; ++i) {
+            out[i] = static_cast<int>(in[i] + static_cast<uint32_t>(base));
+        }
     }
 
-    void on_finished() override {
-        std::cout << "Processing finished.\n";
+    // In-place inclusive prefix sum of deltas, continuing from `previous`.
+    static int prefix_sum(int* values, size_t n, int previous) {
+        size_t i = 0;
+#ifdef __SSE2__
+        __m128i carry = _mm_set1_epi32(previous);
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+            v = _mm_add_epi32(v, carry);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), v);
+            carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+        if (i > 0) previous = values[i - 1];
+#endif
+        for (; i < n; ++i) {
+            previous = static_cast<int>(static_cast<uint32_t>(previous) + static_cast<uint32_t>(values[i]));
+            values[i] = previous;
+        }
+        return previous;
     }
 };
 
-class CountObserver : public INumberObserver {
-    int count = 0;
+class CompressedNumberWriter {
+    Encoding encoding;
+    int fd;
+    std::string out;
+    std::vector<int> block;
+    int previous = 0;
+    uint64_t count = 0;
+
 public:
-    void on_number(int number) override {
-        ++count;
+    CompressedNumberWriter(int fd, Encoding encoding) : encoding(encoding), fd(fd) {
+        CompressedHeader header;
+        header.encoding = static_cast<uint8_t>(encoding);
+        out.append(reinterpret_cast<const char*>(&header), sizeof(header));
     }
 
-    void on_finished() override {
-        std::cout << "Total passed numbers: " << count << "\n";
+    void add(const std::vector<int>& numbers) {
+        for (int n : numbers) {
+            ++count;
+            if (encoding == Encoding::DELTA_VARINT) {
+                uint32_t v = CompressedCodec::zigzag(static_cast<int32_t>(static_cast<uint32_t>(n) - static_cast<uint32_t>(previous)));
+                previous = n;
+                while (v >= 0x80) {
+                    out.push_back(static_cast<char>(v | 0x80));
+                    v >>= 7;
+                }
+                out.push_back(static_cast<char>(v));
+            }
+            else {
+                block.push_back(n);
+                if (block.size() == CompressedCodec::block_size) flush_block();
+            }
+        }
+        if (out.size() >= (1 << 20)) flush();
+    }
+
+    // Writes the tail and patches the value count into the header.
+    bool finish() {
+        if (!block.empty()) flush_block();
+        flush();
+        return ::pwrite(fd, &count, sizeof(count), offsetof(CompressedHeader, count)) == sizeof(count);
+    }
+
+private:
+    void flush_block() {
+        uint32_t values[CompressedCodec::block_size];
+        uint32_t max = 0;
+        if (encoding == Encoding::FRAME_OF_REFERENCE) {
+            int32_t base = *std::min_element(block.begin(), block.end());
+            for (size_t i = 0; i < block.size(); ++i) {
+                values[i] = static_cast<uint32_t>(block[i]) - static_cast<uint32_t>(base);
+                max |= values[i];
+            }
+            out.append(reinterpret_cast<const char*>(&base), sizeof(base));
+        }
+        else {
+            for (size_t i = 0; i < block.size(); ++i) {
+                values[i] = CompressedCodec::zigzag(block[i]);
+                max |= values[i];
+            }
+        }
+        unsigned width = CompressedCodec::bit_width(max);
+        out.push_back(static_cast<char>(width));
+        CompressedCodec::pack(values, block.size(), width, out);
+        block.clear();
+    }
+
+    void flush() {
+        const char* data = out.data();
+        size_t size = out.size();
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) break;
+            data += written;
+            size -= written;
+        }
+        out.clear();
     }
 };
 
-class NumberProcessor {
-    INumberReader& reader;
-    INumberFilter& filter;
-    std::vector<INumberObserver*> observers;
+// Decodes the formats above. Values are decoded a block at a time into a
+// small batch that is handed to the sink (and so filtered) while it is still
+// in cache.
+class CompressedNumberReader : public INumberReader {
+    static constexpr size_t batch_numbers = 4096;
 
 public:
-    NumberProcessor(INumberReader& r, INumberFilter& f, const std::vector<INumberObserver*>& obs)
-        : reader(r), filter(f), observers(obs) {
+    static bool detect(const std::string& filename) {
+        if (filename == "-") return false;
+        std::ifstream in(filename, std::ios::binary);
+        char magic[4] = {};
+        return in.read(magic, 4) && has_magic(magic, 4);
     }
 
-    void run(const std::string& filename) {
-        auto numbers = reader.read_numbers(filename);
-        for (int n : numbers) {
-            if (filter.keep(n)) {
-                for (auto* obs : observers) {
-                    obs->on_number(n);
+    static bool has_magic(const char* data, size_t size) {
+        return size >= 4 && std::memcmp(data, CompressedHeader().magic, 4) == 0;
+    }
+
+    void read_batches(const std::string& filename, const BatchSink& sink) override {
+        MappedFile map(filename);
+        if (!map.valid()) return;
+        decode(map.data(), map.size(), filename, sink);
+    }
+
+    // Decodes a whole compressed stream held in memory; `filename` is only
+    // used in error messages.
+    void decode(const char* data, size_t size, const std::string& filename, const BatchSink& sink) {
+        CompressedHeader header;
+        if (size < sizeof(header)) {
+            std::cout << "Error: Corrupt compressed file: " << filename << "\n";
+            return;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data) + sizeof(header);
+        const uint8_t* end = reinterpret_cast<const uint8_t*>(data) + size;
+        if (stats) stats->bytes += size;
+
+        std::vector<int> batch;
+        batch.reserve(batch_numbers);
+        uint32_t raw[CompressedCodec::block_size];
+        int decoded[CompressedCodec::block_size];
+        int previous = 0;
+        uint64_t remaining = header.count;
+        bool corrupt = false;
+
+        while (remaining > 0 && !corrupt && !cancelled()) {
+            size_t n = std::min<uint64_t>(remaining, CompressedCodec::block_size);
+            {
+                StageTimer timer(stat(stats, &PipelineStats::parse_ns));
+                switch (static_cast<Encoding>(header.encoding)) {
+                case Encoding::DELTA_VARINT:
+                    for (size_t i = 0; i < n && !corrupt; ++i) {
+                        uint32_t v = 0;
+                        unsigned shift = 0;
+                        while (p < end && (*p & 0x80) && shift < 28) {
+                            v |= static_cast<uint32_t>(*p++ & 0x7f) << shift;
+                            shift += 7;
+                        }
+                        if (p == end) corrupt = true;
+                        else v |= static_cast<uint32_t>(*p++) << shift;
+                        raw[i] = v;
+                    }
+                    CompressedCodec::unzigzag(raw, n, decoded);
+                    previous = CompressedCodec::prefix_sum(decoded, n, previous);
+                    break;
+                case Encoding::FRAME_OF_REFERENCE: {
+                    int32_t base;
+                    if (end - p < 5) { corrupt = true; break; }
+                    std::memcpy(&base, p, sizeof(base));
+                    unsigned width = p[4];
+                    p += 5;
+                    size_t bytes = CompressedCodec::packed_bytes(n, width);
+                    if (width > 32 || size_t(end - p) < bytes) { corrupt = true; break; }
+                    CompressedCodec::unpack(p, end, width, n, raw);
+                    CompressedCodec::add_base(raw, n, base, decoded);
+                    p += bytes;
+                    break;
+                }
+                case Encoding::BIT_PACKED: {
+                    if (p == end) { corrupt = true; break; }
+                    unsigned width = *p++;
+                    size_t bytes = CompressedCodec::packed_bytes(n, width);
+                    if (width > 32 || size_t(end - p) < bytes) { corrupt = true; break; }
+                    CompressedCodec::unpack(p, end, width, n, raw);
+                    CompressedCodec::unzigzag(raw, n, decoded);
+                    p += bytes;
+                    break;
                 }
+                default:
+                    corrupt = true;
+                }
+            }
+            if (corrupt) break;
+            batch.insert(batch.end(), decoded, decoded + n);
+            remaining -= n;
+            if (batch.size() >= batch_numbers) {
+                sink(batch);
+                batch.clear();
             }
         }
-        for (auto* obs : observers) {
-            obs->on_finished();
+        if (!batch.empty()) sink(batch);
+        if (corrupt) {
+            std::cout << "Error: Corrupt compressed file: " << filename << "\n";
         }
     }
 };
 
-int main(int argc, char** argv) {
-    if (argc != 3) {
-        std::cout << "Usage: ./number_pipeline <FILTER> <FILE>\n";
-        std::cout << "Example filters: EVEN, ODD, GT5\n";
-        return 1;
-    }
+class FileNumberReader : public INumberReader {
+    static constexpr size_t chunk_size = 1 << 20;
 
-    std::string filter_name = argv[1];
-    std::string file_name = argv[2];
+public:
+    bool splittable(const std::string& filename) const override {
+        std::error_code ec;
+        return filename != "-" && std::filesystem::is_regular_file(filename, ec)
+            && !CompressedNumberReader::detect(filename);
+    }
 
-    FilterFactory::instance().register_filter("EVEN", [](const std::string&) {
-        return std::make_unique<EvenFilter>();
-        });
+    // The format of stdin is only known from its first bytes, so it is left
+    // to read_batches, which checks them.
+    bool reads_text(const std::string& filename) const override {
+        return filename != "-" && !CompressedNumberReader::detect(filename);
+    }
 
-    FilterFactory::instance().register_filter("ODD", [](const std::string&) {
-        return std::make_unique<OddFilter>();
-        });
+    // Streams with plain read(2), so pipes and stdin ("-") work the same way
+    // as regular files.
+    void read_batches(const std::string& filename, const BatchSink& sink) override {
+        if (CompressedNumberReader::detect(filename)) {
+            CompressedNumberReader compressed;
+            compressed.set_stats(stats);
+            compressed.set_cancel(cancel);
+            compressed.read_batches(filename, sink);
+            return;
+        }
+        int fd = open_input(filename);
+        if (fd < 0) return;
 
-    FilterFactory::instance().register_filter("GT", [](const std::string& param) -> std::unique_ptr<INumberFilter> {
-        try {
-            if (param.empty()) throw std::invalid_argument("Missing value");
-            int n = std::stoi(param);
-            return std::make_unique<GTFilter>(n);
+        std::vector<char> buffer(chunk_size);
+        std::vector<int> batch;
+        size_t carry = 0;
+        if (fd == STDIN_FILENO) {
+            // Sniffed bytes stay in the buffer as the start of the text unless
+            // they are the compressed magic.
+            while (carry < sizeof(CompressedHeader().magic)) {
+                ssize_t got = ::read(fd, buffer.data() + carry, sizeof(CompressedHeader().magic) - carry);
+                if (got < 0 && errno == EINTR) continue;
+                if (got <= 0) break;
+                carry += got;
+            }
+            if (CompressedNumberReader::has_magic(buffer.data(), carry)) {
+                read_compressed_stream(fd, std::move(buffer), carry, filename, sink);
+                return;
+            }
+            if (stats) stats->bytes += carry;
         }
-        catch (...) {
-            std::cout << "Error: GT filter requires a numeric value, e.g., GT5\n";
-            return nullptr;
+        while (true) {
+            if (carry == buffer.size()) buffer.resize(buffer.size() * 2);
+            ssize_t got;
+            {
+                StageTimer timer(stat(stats, &PipelineStats::read_ns));
+                got = ::read(fd, buffer.data() + carry, buffer.size() - carry);
+            }
+            if (got < 0 && errno == EINTR) continue;
+            bool last = got <= 0;
+            size_t filled = carry + (got > 0 ? got : 0);
+            if (stats && got > 0) stats->bytes += got;
+
+            ParseResult result;
+            {
+                StageTimer timer(stat(stats, &PipelineStats::parse_ns));
+                result = parse_numbers(buffer.data(), buffer.data() + filled, last, batch);
+            }
+            if (!batch.empty()) sink(batch);
+            batch.clear();
+            if (last || result.stopped || cancelled()) break;
+
+            carry = filled - result.consumed;
+            std::copy(buffer.begin() + result.consumed, buffer.begin() + filled, buffer.begin());
         }
-        });
+        if (fd != STDIN_FILENO) ::close(fd);
+    }
 
-    auto filter = FilterFactory::instance().create(filter_name);
-    if (!filter) return 1;
+private:
+    // Compressed streams are decoded from memory, so the rest of the pipe is
+    // read first.
+    void read_compressed_stream(int fd, std::vector<char> data, size_t size, const std::string& filename, const BatchSink& sink) {
+        while (true) {
+            if (size == data.size()) data.resize(data.size() * 2);
+            ssize_t got;
+            {
+                StageTimer timer(stat(stats, &PipelineStats::read_ns));
+                got = ::read(fd, data.data() + size, data.size() - size);
+            }
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) break;
+            size += got;
+        }
+        CompressedNumberReader compressed;
+        compressed.set_stats(stats);
+        compressed.set_cancel(cancel);
+        compressed.decode(data.data(), size, filename, sink);
+    }
+};
 
+bool convert_to_compressed(const std::string& input, const std::string& output, Encoding encoding) {
+    int fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cout << "Error: Cannot create file: " << output << "\n";
+        return false;
+    }
+    CompressedNumberWriter writer(fd, encoding);
     FileNumberReader reader;
-    PrintObserver printer;
-    CountObserver counter;
+    reader.read_batches(input, [&](const std::vector<int>& batch) { writer.add(batch); });
+    bool ok = writer.finish();
+    ::close(fd);
+    return ok;
+}
+
+// Tails a growing file: starts at the current end and hands over only numbers
+// appended afterwards, until stop_requested is set (SIGINT/SIGTERM).
+class FollowFileReader : public INumberReader {
+public:
+    void read_batches(const std::string& filename, const BatchSink& sink) override {
+        int fd = open_input(filename);
+        if (fd < 0) return;
+        off_t offset = ::lseek(fd, 0, SEEK_END);
+
+        int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notify < 0 || inotify_add_watch(notify, filename.c_str(), IN_MODIFY) < 0) {
+            std::cout << "Error: Cannot watch file: " << filename << "\n";
+            if (notify >= 0) ::close(notify);
+            ::close(fd);
+            return;
+        }
+
+        std::string pending;
+        std::vector<int> batch;
+        char chunk[1 << 16];
+        while (!stop_requested && !cancelled()) {
+            struct stat st{};
+            if (::fstat(fd, &st) == 0 && st.st_size < offset) {
+                offset = 0;
+                pending.clear();
+            }
+
+            ssize_t got;
+            while ((got = ::pread(fd, chunk, sizeof(chunk), offset)) > 0) {
+                pending.append(chunk, got);
+                offset += got;
+            }
+
+            auto result = parse_numbers(pending.data(), pending.data() + pending.size(), false, batch);
+            pending.erase(0, result.consumed);
+            if (result.stopped) {
+                auto skip = pending.find_first_of(" \t\r\n");
+                pending.erase(0, skip == std::string::npos ? pending.size() : skip);
+            }
+            if (!batch.empty()) sink(batch);
+            batch.clear();
 
-    std::vector<INumberObserver*> observers = { &printer, &counter };
+            pollfd pfd{ notify, POLLIN, 0 };
+            if (::poll(&pfd, 1, 1000) > 0) {
+                char events[4096];
+                while (::read(notify, events, sizeof(events)) > 0) {}
+            }
+        }
+
+        parse_numbers(pending.data(), pending.data() + pending.size(), true, batch);
+        if (!batch.empty()) sink(batch);
+        ::close(notify);
+        ::close(fd);
+    }
+};
+
+// Keeps up to `depth` large reads in flight so parsing of one buffer overlaps
+// the I/O for the following ones. Uses io_uring when built with USE_LIBURING
+// and the input is a regular file, otherwise a reader thread fills the ring.
+class ReadAheadFileReader : public INumberReader {
+    struct Slot {
+        std::vector<char> data;
+        size_t size = 0;
+        bool eof = false;
+    };
+
+    size_t depth;
+    size_t buffer_size;
+
+public:
+    ReadAheadFileReader(size_t depth = 4, size_t buffer_size = 4 << 20)
+        : depth(std::max<size_t>(depth, 2)), buffer_size(buffer_size) {
+    }
+
+    // Compressed files are decoded as FileNumberReader does, and stdin goes
+    // through it as well since its format is only known from its first bytes.
+    void read_batches(const std::string& filename, const BatchSink& sink) override {
+        if (filename == "-" || CompressedNumberReader::detect(filename)) {
+            FileNumberReader plain;
+            plain.set_stats(stats);
+            plain.set_cancel(cancel);
+            plain.read_batches(filename, sink);
+            return;
+        }
+        int fd = open_input(filename);
+        if (fd < 0) return;
+
+#ifdef HAVE_LIBURING
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && read_uring(fd, st.st_size, sink)) {
+            ::close(fd);
+            return;
+        }
+#endif
+        read_threaded(fd, sink);
+        if (fd != STDIN_FILENO) ::close(fd);
+    }
+
+private:
+    void read_threaded(int fd, const BatchSink& sink) {
+        std::vector<Slot> slots(depth);
+        for (auto& slot : slots) slot.data.resize(buffer_size);
+
+        std::mutex m;
+        std::condition_variable cv;
+        size_t filled = 0;
+        bool stopping = false;
+
+        std::thread io([&] {
+            for (size_t tail = 0;; tail = (tail + 1) % depth) {
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    cv.wait(lock, [&] { return filled < depth || stopping; });
+                    if (stopping) return;
+                }
+                Slot& slot = slots[tail];
+                slot.size = 0;
+                while (slot.size < slot.data.size()) {
+                    ssize_t got = ::read(fd, slot.data.data() + slot.size, slot.data.size() - slot.size);
+                    if (got < 0 && errno == EINTR) continue;
+                    if (got <= 0) break;
+                    slot.size += got;
+                }
+                slot.eof = slot.size < slot.data.size();
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    ++filled;
+                }
+                cv.notify_all();
+                if (slot.eof) return;
+            }
+            });
+
+        ChunkParser parser;
+        std::vector<int> batch;
+        for (size_t head = 0;; head = (head + 1) % depth) {
+            {
+                StageTimer timer(stat(stats, &PipelineStats::read_ns));
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return filled > 0; });
+            }
+            Slot& slot = slots[head];
+            if (stats) stats->bytes += slot.size;
+            bool more;
+            bool eof = slot.eof;
+            {
+                StageTimer timer(stat(stats, &PipelineStats::parse_ns));
+                more = parser.feed(slot.data.data(), slot.size, batch);
+                if (eof) parser.finish(batch);
+            }
+            if (!batch.empty()) sink(batch);
+            batch.clear();
+            more = more && !cancelled();
+            {
+                std::lock_guard<std::mutex> lock(m);
+                --filled;
+                if (!more) stopping = true;
+            }
+            cv.notify_all();
+            if (eof || !more) break;
+        }
+        io.join();
+    }
+
+#ifdef HAVE_LIBURING
+    bool read_uring(int fd, off_t file_size, const BatchSink& sink) {
+        io_uring ring;
+        if (io_uring_queue_init(depth, &ring, 0) < 0) return false;
+
+        std::vector<Slot> slots(depth);
+        std::vector<off_t> offsets(depth);
+        std::vector<int> done(depth, 0);
+        off_t next_offset = 0;
+        size_t in_flight = 0;
+
+        auto submit = [&](size_t i) {
+            if (next_offset >= file_size) return;
+            slots[i].data.resize(buffer_size);
+            slots[i].size = std::min<off_t>(buffer_size, file_size - next_offset);
+            offsets[i] = next_offset;
+            next_offset += slots[i].size;
+            done[i] = 0;
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_read(sqe, fd, slots[i].data.data(), slots[i].size, offsets[i]);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(i + 1));
+            ++in_flight;
+        };
+
+        for (size_t i = 0; i < depth; ++i) submit(i);
+        io_uring_submit(&ring);
+
+        ChunkParser parser;
+        std::vector<int> batch;
+        bool more = true;
+        bool failed = false;
+        for (size_t head = 0; in_flight > 0; head = (head + 1) % depth) {
+            {
+                StageTimer timer(stat(stats, &PipelineStats::read_ns));
+                while (!done[head]) {
+                    io_uring_cqe* cqe;
+                    if (io_uring_wait_cqe(&ring, &cqe) < 0) continue;
+                    size_t i = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe)) - 1;
+                    done[i] = cqe->res < 0 ? -1 : 1;
+                    if (cqe->res >= 0 && static_cast<size_t>(cqe->res) < slots[i].size) {
+                        ssize_t rest = ::pread(fd, slots[i].data.data() + cqe->res,
+                            slots[i].size - cqe->res, offsets[i] + cqe->res);
+                        if (rest < 0) done[i] = -1;
+                        slots[i].size = cqe->res + std::max<ssize_t>(rest, 0);
+                    }
+                    io_uring_cqe_seen(&ring, cqe);
+                }
+            }
+            --in_flight;
+            // Parsing across a failed read would join the bytes on either
+            // side into wrong numbers, so the input ends here. Reads still in
+            // flight are drained before the ring goes away.
+            if (more && done[head] < 0) {
+                std::cout << "Error: Read failed at offset " << offsets[head] << "\n";
+                more = false;
+                failed = true;
+            }
+            if (more && done[head] > 0) {
+                StageTimer timer(stat(stats, &PipelineStats::parse_ns));
+                if (stats) stats->bytes += slots[head].size;
+                more = parser.feed(slots[head].data.data(), slots[head].size, batch);
+            }
+            if (!batch.empty()) sink(batch);
+            batch.clear();
+            more = more && !cancelled();
+
+            if (more) {
+                submit(head);
+                io_uring_submit(&ring);
+            }
+        }
+        if (!failed) parser.finish(batch);
+        if (!batch.empty()) sink(batch);
+        io_uring_queue_exit(&ring);
+        return true;
+    }
+#endif
+};
+
+// Reads one numeric column of delimited text (CSV, TSV). Only the projected
+// field of each row is copied and parsed; the scanner jumps between
+// delimiters, quotes and newlines 16 bytes at a time, and once the projected
+// field of a row is done it only looks for the end of the row. Quoted fields
+// may contain delimiters and newlines. Fields that are not integers (headers,
+// NULL, blanks) and rows without the column are skipped and counted.
+class DelimitedNumberReader : public INumberReader {
+    static constexpr size_t chunk_size = 1 << 20;
+
+    char delimiter;
+    size_t column;
+    bool header;
+
+    struct State {
+        size_t field = 0;
+        size_t row = 0;
+        bool quoted = false;
+        bool seen = false;
+        bool content = false;
+        bool closed_quote = false;
+        std::string text;
+        size_t skipped = 0;
+    };
+
+public:
+    DelimitedNumberReader(char delimiter, size_t column, bool header = false)
+        : delimiter(delimiter), column(column), header(header) {
+    }
+
+    void read_batches(const std::string& filename, const BatchSink& sink) override {
+        int fd = open_input(filename);
+        if (fd < 0) return;
+
+        std::vector<char> buffer(chunk_size);
+        std::vector<int> batch;
+        State state;
+        while (!cancelled()) {
+            ssize_t got;
+            {
+                StageTimer timer(stat(stats, &PipelineStats::read_ns));
+                got = ::read(fd, buffer.data(), buffer.size());
+            }
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) break;
+            if (stats) stats->bytes += got;
+            {
+                StageTimer timer(stat(stats, &PipelineStats::parse_ns));
+                scan(buffer.data(), buffer.data() + got, state, batch);
+            }
+            if (!batch.empty()) sink(batch);
+            batch.clear();
+        }
+        end_row(state, batch);
+        if (!batch.empty()) sink(batch);
+        if (fd != STDIN_FILENO) ::close(fd);
+        if (state.skipped > 0) {
+            std::cout << "Warning: skipped " << state.skipped << " rows without a number in column " << column + 1 << "\n";
+        }
+    }
+
+private:
+    // Finds the next delimiter, quote or newline, or with rest_of_row only
+    // the next quote or newline.
+    template <bool rest_of_row>
+    const char* next_special(const char* p, const char* end) const {
+#ifdef __SSE2__
+        const __m128i newline = _mm_set1_epi8('\n');
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i delim = _mm_set1_epi8(delimiter);
+        for (; p + 16 <= end; p += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(block, newline), _mm_cmpeq_epi8(block, quote));
+            if (!rest_of_row) hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, delim));
+            int mask = _mm_movemask_epi8(hits);
+            if (mask) return p + __builtin_ctz(mask);
+        }
+#endif
+        for (; p < end; ++p) {
+            if (*p == '\n' || *p == '"' || (!rest_of_row && *p == delimiter)) return p;
+        }
+        return end;
+    }
+
+    void scan(const char* p, const char* end, State& state, std::vector<int>& out) const {
+        while (p < end) {
+            bool projected = state.field == column;
+            const char* q = state.field > column && !state.quoted
+                ? next_special<true>(p, end)
+                : next_special<false>(p, end);
+            if (projected) state.text.append(p, q);
+            if (q == end) {
+                state.content |= q > p;
+                return;
+            }
+            char c = *q;
+            state.content |= q > p || c != '\n';
+            if (q > p) state.closed_quote = false;
+            p = q + 1;
+            if (c == '"') {
+                // A quote right after a closing quote is an escaped literal one.
+                if (state.closed_quote && projected) state.text.push_back('"');
+                state.closed_quote = state.quoted;
+                state.quoted = !state.quoted;
+                continue;
+            }
+            state.closed_quote = false;
+            if (state.quoted) {
+                if (projected) state.text.push_back(c);
+            }
+            else if (c == delimiter) {
+                end_field(state, out);
+                ++state.field;
+            }
+            else {
+                end_row(state, out);
+            }
+        }
+    }
+
+    void end_field(State& state, std::vector<int>& out) const {
+        if (state.field != column) return;
+        state.seen = true;
+        if (header && state.row == 0) return;
+        const char* begin = state.text.data();
+        const char* end = begin + state.text.size();
+        while (begin < end && std::isspace(static_cast<unsigned char>(*begin))) ++begin;
+        while (end > begin && std::isspace(static_cast<unsigned char>(end[-1]))) --end;
+        if (begin < end && *begin == '+') ++begin;
+        int value;
+        auto [ptr, ec] = std::from_chars(begin, end, value);
+        if (ec == std::errc() && ptr == end && begin < end) out.push_back(value);
+        else ++state.skipped;
+        state.text.clear();
+    }
+
+    void end_row(State& state, std::vector<int>& out) const {
+        bool blank = !state.content;
+        end_field(state, out);
+        if (!state.seen && !blank && !(header && state.row == 0)) ++state.skipped;
+        if (!blank) ++state.row;
+        state.field = 0;
+        state.seen = false;
+        state.content = false;
+        state.closed_quote = false;
+        state.quoted = false;
+        state.text.clear();
+    }
+};
+
+class EvenFilter : public INumberFilter {
+public:
+    bool keep(int number) override {
+        return number % 2 == 0;
+    }
+
+    size_t select(const int* values, size_t count, uint32_t* selection) override {
+#ifdef __SSE2__
+        const __m128i one = _mm_set1_epi32(1);
+        return select_simd(values, count, selection,
+            [&](__m128i v) { return _mm_cmpeq_epi32(_mm_and_si128(v, one), _mm_setzero_si128()); },
+            [](int n) { return (n & 1) == 0; });
+#else
+        return select_branchless(values, count, selection, [](int n) { return (n & 1) == 0; });
+#endif
+    }
+
+    std::unique_ptr<INumberFilter> clone() const override {
+        return std::make_unique<EvenFilter>();
+    }
+};
+
+class OddFilter : public INumberFilter {
+public:
+    bool keep(int number) override {
+        return number % 2 != 0;
+    }
+
+    size_t select(const int* values, size_t count, uint32_t* selection) override {
+#ifdef __SSE2__
+        const __m128i one = _mm_set1_epi32(1);
+        return select_simd(values, count, selection,
+            [&](__m128i v) { return _mm_cmpeq_epi32(_mm_and_si128(v, one), one); },
+            [](int n) { return (n & 1) != 0; });
+#else
+        return select_branchless(values, count, selection, [](int n) { return (n & 1) != 0; });
+#endif
+    }
+
+    std::unique_ptr<INumberFilter> clone() const override {
+        return std::make_unique<OddFilter>();
+    }
+};
+
+class GTFilter : public INumberFilter {
+    int threshold;
+public:
+    GTFilter(int n) : threshold(n) {}
+    bool keep(int number) override {
+        return number > threshold;
+    }
+
+    size_t select(const int* values, size_t count, uint32_t* selection) override {
+        int t = threshold;
+#ifdef __SSE2__
+        const __m128i limit = _mm_set1_epi32(t);
+        return select_simd(values, count, selection,
+            [&](__m128i v) { return _mm_cmpgt_epi32(v, limit); },
+            [t](int n) { return n > t; });
+#else
+        return select_branchless(values, count, selection, [t](int n) { return n > t; });
+#endif
+    }
+
+    std::unique_ptr<INumberFilter> clone() const override {
+        return std::make_unique<GTFilter>(threshold);
+    }
+};
+
+class LTFilter : public INumberFilter {
+    int threshold;
+public:
+    LTFilter(int n) : threshold(n) {}
+    bool keep(int number) override {
+        return number < threshold;
+    }
+
+    size_t select(const int* values, size_t count, uint32_t* selection) override {
+        int t = threshold;
+#ifdef __SSE2__
+        const __m128i limit = _mm_set1_epi32(t);
+        return select_simd(values, count, selection,
+            [&](__m128i v) { return _mm_cmplt_epi32(v, limit); },
+            [t](int n) { return n < t; });
+#else
+        return select_branchless(values, count, selection, [t](int n) { return n < t; });
+#endif
+    }
+
+    std::unique_ptr<INumberFilter> clone() const override {
+        return std::make_unique<LTFilter>(threshold);
+    }
+};
+
+// Inclusive range as one unsigned compare: n - low wraps above the width of
+// the range for every value outside it.
+class BetweenFilter : public INumberFilter {
+    int low;
+    int high;
+    uint32_t width;
+public:
+    BetweenFilter(int low, int high)
+        : low(low), high(high), width(static_cast<uint32_t>(high) - static_cast<uint32_t>(low)) {
+    }
+
+    bool keep(int number) override {
+        return static_cast<uint32_t>(number) - static_cast<uint32_t>(low) <= width;
+    }
+
+    size_t select(const int* values, size_t count, uint32_t* selection) override {
+        uint32_t base = static_cast<uint32_t>(low);
+        uint32_t w = width;
+#ifdef __SSE2__
+        // SSE2 has no unsigned compare; flipping the sign bit maps it onto the signed one.
+        const __m128i bias = _mm_set1_epi32(INT32_MIN);
+        const __m128i start = _mm_set1_epi32(low);
+        const __m128i limit = _mm_set1_epi32(static_cast<int>(w ^ 0x80000000u));
+        return select_simd(values, count, selection,
+            [&](__m128i v) {
+                __m128i offset = _mm_xor_si128(_mm_sub_epi32(v, start), bias);
+                return _mm_xor_si128(_mm_cmpgt_epi32(offset, limit), _mm_set1_epi32(-1));
+            },
+            [base, w](int n) { return static_cast<uint32_t>(n) - base <= w; });
+#else
+        return select_branchless(values, count, selection,
+            [base, w](int n) { return static_cast<uint32_t>(n) - base <= w; });
+#endif
+    }
+
+    std::unique_ptr<INumberFilter> clone() const override {
+        return std::make_unique<BetweenFilter>(low, high);
+    }
+};
+
+// Set membership. Dense sets use a bitset over [min, max]; sparse sets use a
+// two-level perfect hash (Fredman-Komlos-Szemeredi) with multiply-shift
+// hashing, so n values take under 16n slots and a probe is two loads and a
+// compare. Lookups are branch-free but scalar: SSE2 has no gather. The tables
+// are immutable and shared by every clone.
+class InSetFilter : public INumberFilter {
+    struct Bucket {
+        uint32_t offset = 0;
+        uint32_t multiplier = 0;
+        uint32_t shift = 32;
+    };
+
+    struct Lookup {
+        std::vector<int> members;
+        bool dense = false;
+        int min = 0;
+        uint32_t range = 0;
+        std::vector<uint64_t> bits;
+        uint32_t multiplier = 0;
+        uint32_t shift = 32;
+        std::vector<Bucket> buckets;
+        std::vector<int> slots;
+    };
+
+    std::shared_ptr<const Lookup> lookup;
+
+    // The top `32 - shift` bits of n * multiplier; a shift of 32 gives 0.
+    static uint32_t hash(int n, uint32_t multiplier, uint32_t shift) {
+        return static_cast<uint32_t>(uint64_t(static_cast<uint32_t>(n) * multiplier) >> shift);
+    }
+
+    explicit InSetFilter(std::shared_ptr<const Lookup> lookup) : lookup(std::move(lookup)) {
+    }
+
+public:
+    explicit InSetFilter(std::vector<int> values) {
+        auto table = std::make_shared<Lookup>();
+        auto& members = table->members;
+        members = std::move(values);
+        std::sort(members.begin(), members.end());
+        members.erase(std::unique(members.begin(), members.end()), members.end());
+        table->min = members.front();
+        table->range = static_cast<uint32_t>(members.back()) - static_cast<uint32_t>(table->min);
+        table->dense = table->range / 8 <= members.size() * 32 + 4096;
+        if (table->dense) {
+            table->bits.assign(table->range / 64 + 1, 0);
+            for (int n : members) {
+                uint32_t offset = static_cast<uint32_t>(n) - static_cast<uint32_t>(table->min);
+                table->bits[offset / 64] |= 1ull << (offset % 64);
+            }
+        }
+        else {
+            build_perfect_hash(*table);
+        }
+        lookup = std::move(table);
+    }
+
+    bool keep(int number) override {
+        const Lookup& t = *lookup;
+        if (t.dense) {
+            uint32_t offset = static_cast<uint32_t>(number) - static_cast<uint32_t>(t.min);
+            return offset <= t.range && ((t.bits[offset / 64] >> (offset % 64)) & 1);
+        }
+        const Bucket& bucket = t.buckets[hash(number, t.multiplier, t.shift)];
+        return t.slots[bucket.offset + hash(number, bucket.multiplier, bucket.shift)] == number;
+    }
+
+    size_t select(const int* values, size_t count, uint32_t* selection) override {
+        const Lookup& t = *lookup;
+        if (t.dense) {
+            const uint64_t* words = t.bits.data();
+            uint32_t base = static_cast<uint32_t>(t.min);
+            uint32_t limit = t.range;
+            return select_branchless(values, count, selection, [=](int n) {
+                uint32_t offset = static_cast<uint32_t>(n) - base;
+                uint32_t clamped = offset <= limit ? offset : 0;
+                return (offset <= limit) & static_cast<bool>((words[clamped / 64] >> (clamped % 64)) & 1);
+                });
+        }
+        const Bucket* buckets = t.buckets.data();
+        const int* slots = t.slots.data();
+        uint32_t multiplier = t.multiplier;
+        uint32_t shift = t.shift;
+        return select_branchless(values, count, selection, [=](int n) {
+            const Bucket& bucket = buckets[hash(n, multiplier, shift)];
+            return slots[bucket.offset + hash(n, bucket.multiplier, bucket.shift)] == n;
+            });
+    }
+
+    std::unique_ptr<INumberFilter> clone() const override {
+        return std::unique_ptr<InSetFilter>(new InSetFilter(lookup));
+    }
+
+private:
+    // The first level spreads n values over at least n buckets and is redrawn
+    // until the squared bucket sizes sum to at most 4n. A bucket of k values
+    // gets at least 2k^2 slots and a multiplier drawn until it is
+    // collision-free. Unused slots hold a member whose own slot is elsewhere,
+    // so a probe of an unused slot can never match.
+    static void build_perfect_hash(Lookup& t) {
+        std::mt19937 rng(12345);
+        size_t n = t.members.size();
+        unsigned log = n > 1 ? CompressedCodec::bit_width(static_cast<uint32_t>(n - 1)) : 0;
+        t.shift = 32 - log;
+        std::vector<std::vector<int>> groups(size_t(1) << log);
+        while (true) {
+            t.multiplier = rng() | 1;
+            for (auto& group : groups) group.clear();
+            for (int v : t.members) groups[hash(v, t.multiplier, t.shift)].push_back(v);
+            size_t squares = 0;
+            for (const auto& group : groups) squares += group.size() * group.size();
+            if (squares <= 4 * n) break;
+        }
+
+        t.buckets.resize(groups.size());
+        std::vector<bool> used;
+        for (size_t b = 0; b < groups.size(); ++b) {
+            const auto& group = groups[b];
+            size_t k = group.size();
+            unsigned bucket_log = k > 1 ? CompressedCodec::bit_width(static_cast<uint32_t>(2 * k * k - 1)) : 0;
+            Bucket& bucket = t.buckets[b];
+            bucket.offset = static_cast<uint32_t>(t.slots.size());
+            bucket.shift = 32 - bucket_log;
+            t.slots.resize(t.slots.size() + (size_t(1) << bucket_log), t.members.front());
+            for (bool placed = false; !placed;) {
+                bucket.multiplier = rng() | 1;
+                used.assign(size_t(1) << bucket_log, false);
+                placed = true;
+                for (int v : group) {
+                    uint32_t slot = hash(v, bucket.multiplier, bucket.shift);
+                    if (used[slot]) {
+                        placed = false;
+                        break;
+                    }
+                    used[slot] = true;
+                }
+            }
+            for (int v : group) t.slots[bucket.offset + hash(v, bucket.multiplier, bucket.shift)] = v;
+        }
+    }
+};
+
+// n % k == r with C++ remainder semantics. The division uses a precomputed
+// multiply-shift reciprocal (Granlund-Montgomery, as in libdivide) applied
+// to |n|, so no hardware divide runs per value.
+class ModFilter : public INumberFilter {
+    int divisor;
+    int remainder;
+    uint32_t d;
+    uint32_t magic;
+    unsigned shift1;
+    unsigned shift2;
+
+    uint32_t unsigned_mod(uint32_t a) const {
+        uint32_t t = static_cast<uint32_t>((static_cast<uint64_t>(magic) * a) >> 32);
+        uint32_t q = (t + ((a - t) >> shift1)) >> shift2;
+        return a - q * d;
+    }
+
+public:
+    ModFilter(int k, int r) : divisor(k), remainder(r) {
+        d = k < 0 ? 0u - static_cast<uint32_t>(k) : static_cast<uint32_t>(k);
+        unsigned l = d > 1 ? CompressedCodec::bit_width(d - 1) : 0;
+        magic = static_cast<uint32_t>(((uint64_t(1) << 32) * ((uint64_t(1) << l) - d)) / d + 1);
+        shift1 = std::min(l, 1u);
+        shift2 = l > 0 ? l - 1 : 0;
+    }
+
+    bool keep(int number) override {
+        uint32_t sign = number < 0 ? 0xffffffffu : 0;
+        uint32_t r = unsigned_mod((static_cast<uint32_t>(number) ^ sign) - sign);
+        return static_cast<int>((r ^ sign) - sign) == remainder;
+    }
+
+    size_t select(const int* values, size_t count, uint32_t* selection) override {
+#ifdef __SSE2__
+        const __m128i m = _mm_set1_epi32(static_cast<int>(magic));
+        const __m128i div = _mm_set1_epi32(static_cast<int>(d));
+        const __m128i want = _mm_set1_epi32(remainder);
+        const __m128i s1 = _mm_cvtsi32_si128(shift1);
+        const __m128i s2 = _mm_cvtsi32_si128(shift2);
+        return select_simd(values, count, selection,
+            [&](__m128i v) {
+                __m128i sign = _mm_srai_epi32(v, 31);
+                __m128i a = _mm_sub_epi32(_mm_xor_si128(v, sign), sign);
+                __m128i t = mulhi_epu32(a, m);
+                __m128i q = _mm_srl_epi32(_mm_add_epi32(t, _mm_srl_epi32(_mm_sub_epi32(a, t), s1)), s2);
+                __m128i r = _mm_sub_epi32(a, mullo_epu32(q, div));
+                return _mm_cmpeq_epi32(_mm_sub_epi32(_mm_xor_si128(r, sign), sign), want);
+            },
+            [this](int n) { return keep(n); });
+#else
+        return select_branchless(values, count, selection, [this](int n) { return keep(n); });
+#endif
+    }
+
+    std::unique_ptr<INumberFilter> clone() const override {
+        return std::make_unique<ModFilter>(divisor, remainder);
+    }
+
+private:
+#ifdef __SSE2__
+    static __m128i mulhi_epu32(__m128i a, __m128i b) {
+        __m128i even = _mm_srli_epi64(_mm_mul_epu32(a, b), 32);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+        return _mm_or_si128(even, _mm_and_si128(odd, _mm_set_epi32(-1, 0, -1, 0)));
+    }
+
+    static __m128i mullo_epu32(__m128i a, __m128i b) {
+        __m128i even = _mm_mul_epu32(a, b);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+#endif
+};
+
+// AND of several filters ("EVEN&GT5"). Every `chunk` calls the terms are
+// re-timed and re-measured on a sample of recent inputs and reordered by
+// cost / (1 - pass rate), so cheap, selective terms reject numbers first.
+class ConjunctionFilter : public INumberFilter {
+    static constexpr size_t chunk = 8192;
+    static constexpr size_t sample_every = 32;
+    static constexpr size_t sample_size = 256;
+
+    std::vector<std::unique_ptr<INumberFilter>> terms;
+    std::vector<int> sample;
+    std::vector<int> gathered;
+    std::vector<uint32_t> refined;
+    size_t calls = 0;
+
+public:
+    explicit ConjunctionFilter(std::vector<std::unique_ptr<INumberFilter>> t)
+        : terms(std::move(t)) {
+        sample.reserve(sample_size);
+    }
+
+    bool keep(int number) override {
+        if (++calls % sample_every == 0) {
+            if (sample.size() < sample_size) sample.push_back(number);
+            else sample[(calls / sample_every) % sample_size] = number;
+        }
+        if (calls % chunk == 0) reorder();
+
+        for (auto& term : terms) {
+            if (!term->keep(number)) return false;
+        }
+        return true;
+    }
+
+    // Terms refine the selection one after another on the values that are
+    // still alive; the order is re-evaluated once per batch.
+    size_t select(const int* values, size_t count, uint32_t* selection) override {
+        for (size_t i = sample_every - 1; i < count; i += sample_every) {
+            if (sample.size() < sample_size) sample.push_back(values[i]);
+            else sample[(++calls) % sample_size] = values[i];
+        }
+        reorder();
+
+        size_t passed = terms[0]->select(values, count, selection);
+        gathered.resize(count);
+        refined.resize(count);
+        for (size_t t = 1; t < terms.size() && passed > 0; ++t) {
+            for (size_t i = 0; i < passed; ++i) gathered[i] = values[selection[i]];
+            size_t kept = terms[t]->select(gathered.data(), passed, refined.data());
+            for (size_t i = 0; i < kept; ++i) selection[i] = selection[refined[i]];
+            passed = kept;
+        }
+        return passed;
+    }
+
+    std::unique_ptr<INumberFilter> clone() const override {
+        std::vector<std::unique_ptr<INumberFilter>> copies;
+        for (const auto& term : terms) copies.push_back(term->clone());
+        return std::make_unique<ConjunctionFilter>(std::move(copies));
+    }
+
+private:
+    void reorder() {
+        if (terms.size() < 2 || sample.empty()) return;
+        std::vector<std::pair<double, size_t>> ranks;
+        for (size_t i = 0; i < terms.size(); ++i) {
+            size_t passed = 0;
+            uint64_t start = now_ns();
+            for (int n : sample) passed += terms[i]->keep(n);
+            double cost = double(now_ns() - start) / sample.size();
+            double reject = 1.0 - double(passed) / sample.size();
+            ranks.emplace_back(reject > 0 ? cost / reject : 1e300, i);
+        }
+        std::stable_sort(ranks.begin(), ranks.end());
+
+        std::vector<std::unique_ptr<INumberFilter>> ordered;
+        for (const auto& [rank, i] : ranks) ordered.push_back(std::move(terms[i]));
+        terms = std::move(ordered);
+    }
+};
+
+class FilterFactory {
+    using Creator = std::function<std::unique_ptr<INumberFilter>(const std::string&)>;
+    std::map<std::string, Creator> registry;
+
+public:
+    static FilterFactory& instance() {
+        static FilterFactory factory;
+        return factory;
+    }
+
+    void register_filter(const std::string& prefix, Creator creator) {
+        registry[prefix] = creator;
+    }
+
+    std::unique_ptr<INumberFilter> create(const std::string& name) {
+        if (name.find('&') != std::string::npos) {
+            std::vector<std::unique_ptr<INumberFilter>> terms;
+            size_t from = 0;
+            while (from <= name.size()) {
+                size_t to = std::min(name.find('&', from), name.size());
+                auto term = create(name.substr(from, to - from));
+                if (!term) return nullptr;
+                terms.push_back(std::move(term));
+                from = to + 1;
+            }
+            return std::make_unique<ConjunctionFilter>(std::move(terms));
+        }
+
+        for (const auto& [prefix, creator] : registry) {
+            if (name.starts_with(prefix)) {
+                return creator(name.substr(prefix.size()));
+            }
+        }
+
+        std::cout << "Error: Unknown filter: " << name << "\n";
+        return nullptr;
+    }
+
+private:
+    FilterFactory() = default;
+};
+
+// Formats into a large buffer with to_chars and hands full buffers to
+// write(2). Buffers are flushed only on line boundaries, so writers sharing a
+// descriptor never interleave partial lines.
+class BufferedWriter {
+    int fd;
+    std::vector<char> buffer;
+    size_t used = 0;
+
+    // One lock per descriptor: writers sharing a descriptor take turns, and a
+    // blocked descriptor never stalls writers of another.
+    static std::mutex& fd_mutex(int fd) {
+        static std::mutex registry;
+        static std::unordered_map<int, std::unique_ptr<std::mutex>> mutexes;
+        std::lock_guard<std::mutex> lock(registry);
+        auto& m = mutexes[fd];
+        if (!m) m = std::make_unique<std::mutex>();
+        return *m;
+    }
+
+public:
+    explicit BufferedWriter(int fd = STDOUT_FILENO, size_t capacity = 1 << 20)
+        : fd(fd), buffer(capacity) {
+    }
+
+    ~BufferedWriter() {
+        flush();
+    }
+
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+    void put(std::string_view text) {
+        if (used + text.size() > buffer.size()) flush();
+        if (text.size() > buffer.size()) {
+            write_all(text.data(), text.size());
+            return;
+        }
+        std::memcpy(buffer.data() + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    void put_line(std::string_view prefix, int number, char end = '\n') {
+        if (used + prefix.size() + 12 > buffer.size()) flush();
+        std::memcpy(buffer.data() + used, prefix.data(), prefix.size());
+        used += prefix.size();
+        auto result = std::to_chars(buffer.data() + used, buffer.data() + buffer.size(), number);
+        used = result.ptr - buffer.data();
+        buffer[used++] = end;
+    }
+
+    void flush() {
+        if (used == 0) return;
+        write_all(buffer.data(), used);
+        used = 0;
+    }
+
+private:
+    void write_all(const char* data, size_t size) {
+        std::lock_guard<std::mutex> lock(fd_mutex(fd));
+        if (fd == STDOUT_FILENO) std::cout.flush();
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return;
+            data += written;
+            size -= written;
+        }
+    }
+};
+
+class PrintObserver : public INumberObserver {
+    BufferedWriter out;
+    bool bare;
+    int fd;
+    std::string label;
+    std::string prefix;
+
+public:
+    explicit PrintObserver(bool bare = false, int fd = STDOUT_FILENO, const std::string& label = "")
+        : out(fd), bare(bare), fd(fd), label(label) {
+        if (bare) prefix = label.empty() ? "" : label + " ";
+        else prefix = (label.empty() ? "" : "[" + label + "] ") + "Number passed: ";
+    }
+
+    void on_number(int number) override {
+        out.put_line(prefix, number);
+    }
+
+    void on_batch(const int* values, const uint32_t* selection, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            out.put_line(prefix, values[selection[i]]);
+        }
+    }
+
+    bool forkable() const override {
+        return true;
+    }
+
+    std::unique_ptr<INumberObserver> fork() const override {
+        return std::make_unique<PrintObserver>(bare, fd, label);
+    }
+
+    void merge(INumberObserver& other) override {
+        static_cast<PrintObserver&>(other).out.flush();
+    }
+
+    void on_progress() override {
+        out.flush();
+    }
+
+    void on_finished() override {
+        if (!bare) out.put((label.empty() ? "" : "[" + label + "] ") + "Processing finished.\n");
+        out.flush();
+    }
+
+    const char* name() const override {
+        return "PrintObserver";
+    }
+};
+
+// Opens an anonymous read/write file in dir, using O_TMPFILE where the
+// filesystem supports it and an immediately unlinked mkstemp file otherwise.
+int open_temp_file(const std::string& dir) {
+    int fd = ::open(dir.c_str(), O_TMPFILE | O_RDWR, 0600);
+    if (fd >= 0) return fd;
+    std::string name = dir + "/.number_pipeline.XXXXXX";
+    fd = ::mkstemp(name.data());
+    if (fd >= 0) ::unlink(name.c_str());
+    return fd;
+}
+
+// Writes passing numbers to a file as text lines or raw native int32s.
+// Forked copies write to unlinked temporary segments next to the output;
+// on_finished appends them either with copy_file_range or, with use_mmap, by
+// growing the output with ftruncate and filling the mapping in parallel.
+// There is one segment per worker lane, not per input: a lane takes whole
+// files, so each file's numbers stay in input order, but with several files
+// and jobs the order of files in the output depends on scheduling.
+class FileWriterObserver : public INumberObserver {
+public:
+    enum class Format { TEXT, BINARY };
+
+private:
+    static constexpr size_t buffer_size = 1 << 20;
+    static constexpr size_t alignment = 4096;
+
+    struct Segment {
+        int fd;
+        size_t size;
+    };
+
+    std::string path;
+    Format format;
+    bool use_mmap;
+    int fd = -1;
+    size_t written = 0;
+    char* buffer;
+    size_t used = 0;
+    std::vector<Segment> segments;
+
+    struct SegmentTag {};
+
+    FileWriterObserver(SegmentTag, const FileWriterObserver& parent)
+        : path(parent.path), format(parent.format), use_mmap(parent.use_mmap),
+          buffer(static_cast<char*>(std::aligned_alloc(alignment, buffer_size))) {
+        std::string dir = std::filesystem::path(path).parent_path().string();
+        fd = open_temp_file(dir.empty() ? "." : dir);
+    }
+
+public:
+    FileWriterObserver(const std::string& path, Format format, bool use_mmap = false)
+        : path(path), format(format), use_mmap(use_mmap),
+          buffer(static_cast<char*>(std::aligned_alloc(alignment, buffer_size))) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cout << "Error: Cannot create file: " << path << "\n";
+        }
+    }
+
+    ~FileWriterObserver() {
+        std::free(buffer);
+        if (fd >= 0) ::close(fd);
+        for (auto& segment : segments) ::close(segment.fd);
+    }
+
+    FileWriterObserver(const FileWriterObserver&) = delete;
+    FileWriterObserver& operator=(const FileWriterObserver&) = delete;
+
+    bool valid() const {
+        return fd >= 0;
+    }
+
+    void on_number(int number) override {
+        if (used + 12 > buffer_size) flush();
+        if (format == Format::BINARY) {
+            std::memcpy(buffer + used, &number, sizeof(number));
+            used += sizeof(number);
+        }
+        else {
+            used = std::to_chars(buffer + used, buffer + buffer_size, number).ptr - buffer;
+            buffer[used++] = '\n';
+        }
+    }
+
+    bool forkable() const override {
+        return true;
+    }
+
+    std::unique_ptr<INumberObserver> fork() const override {
+        return std::unique_ptr<FileWriterObserver>(new FileWriterObserver(SegmentTag{}, *this));
+    }
+
+    void merge(INumberObserver& other) override {
+        auto& segment = static_cast<FileWriterObserver&>(other);
+        segment.flush();
+        if (segment.fd < 0) return;
+        segments.push_back({ segment.fd, segment.written });
+        segment.fd = -1;
+    }
+
+    void on_progress() override {
+        flush();
+    }
+
+    void on_finished() override {
+        flush();
+        if (fd < 0) return;
+        size_t total = written;
+        for (const auto& segment : segments) total += segment.size;
+        if (!segments.empty()) {
+            bool ok = use_mmap ? append_mapped(total) : append_copied();
+            if (!ok) std::cout << "Error: Cannot assemble output file: " << path << "\n";
+        }
+        for (auto& segment : segments) ::close(segment.fd);
+        segments.clear();
+        std::cout << "Results written to: " << path << " (" << total << " bytes)\n";
+        written = total;
+    }
+
+    const char* name() const override {
+        return "FileWriterObserver";
+    }
+
+private:
+    void flush() {
+        size_t offset = 0;
+        while (fd >= 0 && offset < used) {
+            ssize_t n = ::write(fd, buffer + offset, used - offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            offset += n;
+        }
+        written += offset;
+        used = 0;
+    }
+
+    bool append_copied() {
+        loff_t out_offset = written;
+        for (const auto& segment : segments) {
+            loff_t in_offset = 0;
+            while (static_cast<size_t>(in_offset) < segment.size) {
+                ssize_t n = ::copy_file_range(segment.fd, &in_offset, fd, &out_offset,
+                    segment.size - in_offset, 0);
+                if (n > 0) continue;
+                if (n < 0 && errno == EINTR) continue;
+                if (!copy_with_pread(segment, in_offset, out_offset)) return false;
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool copy_with_pread(const Segment& segment, loff_t& in_offset, loff_t& out_offset) {
+        while (static_cast<size_t>(in_offset) < segment.size) {
+            ssize_t n = ::pread(segment.fd, buffer, std::min(buffer_size, segment.size - in_offset), in_offset);
+            if (n <= 0 || ::pwrite(fd, buffer, n, out_offset) != n) return false;
+            in_offset += n;
+            out_offset += n;
+        }
+        return true;
+    }
+
+    bool append_mapped(size_t total) {
+        // Nothing to append, and an empty mapping would fail.
+        if (total == written) return true;
+        if (::ftruncate(fd, total) != 0) return false;
+        void* map = ::mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) return false;
+
+        std::atomic<bool> ok{ true };
+        std::vector<std::thread> copiers;
+        size_t offset = written;
+        for (const auto& segment : segments) {
+            if (segment.size == 0) continue;
+            copiers.emplace_back([&, segment, offset] {
+                char* dest = static_cast<char*>(map) + offset;
+                size_t done = 0;
+                while (done < segment.size) {
+                    ssize_t n = ::pread(segment.fd, dest + done, segment.size - done, done);
+                    if (n <= 0) {
+                        ok = false;
+                        return;
+                    }
+                    done += n;
+                }
+                });
+            offset += segment.size;
+        }
+        for (auto& copier : copiers) copier.join();
+        ::munmap(map, total);
+        return ok;
+    }
+};
+
+// Splits passing numbers over `count` files named <prefix>.<i>, by a
+// multiplicative hash or by equal-width value ranges. Every copy keeps one
+// buffer per partition and writes full buffers with a single write(2) to the
+// shared O_APPEND descriptor, which appends each block whole, so workers
+// never take a lock. Blocks from different workers interleave in a file.
+class PartitionedWriterObserver : public INumberObserver {
+public:
+    enum class Scheme { HASH, RANGE };
+
+private:
+    struct Files {
+        std::vector<int> fds;
+        ~Files() {
+            for (int fd : fds) if (fd >= 0) ::close(fd);
+        }
+    };
+
+    std::string prefix;
+    Scheme scheme;
+    FileWriterObserver::Format format;
+    int64_t min;
+    int64_t width;
+    std::shared_ptr<Files> files;
+    size_t buffer_size;
+    std::vector<char> buffers;
+    std::vector<size_t> used;
+    std::shared_ptr<std::atomic<uint64_t>> written;
+
+public:
+    PartitionedWriterObserver(const std::string& prefix, size_t count, Scheme scheme, FileWriterObserver::Format format,
+        int64_t min = std::numeric_limits<int>::min(), int64_t max = std::numeric_limits<int>::max())
+        : prefix(prefix), scheme(scheme), format(format), min(min),
+          width(std::max<int64_t>(1, (max - min) / int64_t(std::max<size_t>(count, 1)) + 1)),
+          files(std::make_shared<Files>()), written(std::make_shared<std::atomic<uint64_t>>(0)) {
+        for (size_t i = 0; i < std::max<size_t>(count, 1); ++i) {
+            std::string path = prefix + "." + std::to_string(i);
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+            if (fd < 0) std::cout << "Error: Cannot create file: " << path << "\n";
+            files->fds.push_back(fd);
+        }
+        allocate();
+    }
+
+    ~PartitionedWriterObserver() {
+        flush();
+    }
+
+    bool valid() const {
+        return std::all_of(files->fds.begin(), files->fds.end(), [](int fd) { return fd >= 0; });
+    }
+
+    void on_number(int number) override {
+        size_t part = partition(number);
+        char* buffer = buffers.data() + part * buffer_size;
+        size_t& size = used[part];
+        if (size + 12 > buffer_size) write_block(part);
+        if (format == FileWriterObserver::Format::BINARY) {
+            std::memcpy(buffer + size, &number, sizeof(number));
+            size += sizeof(number);
+        }
+        else {
+            size = std::to_chars(buffer + size, buffer + buffer_size, number).ptr - buffer;
+            buffer[size++] = '\n';
+        }
+    }
+
+    bool forkable() const override {
+        return true;
+    }
+
+    std::unique_ptr<INumberObserver> fork() const override {
+        return std::unique_ptr<PartitionedWriterObserver>(new PartitionedWriterObserver(*this));
+    }
+
+    void merge(INumberObserver& other) override {
+        static_cast<PartitionedWriterObserver&>(other).flush();
+    }
+
+    void on_progress() override {
+        flush();
+    }
+
+    void on_finished() override {
+        flush();
+        std::cout << "Results written to: " << prefix << ".0 .. " << prefix << "." << files->fds.size() - 1
+            << " (" << written->load() << " bytes)\n";
+    }
+
+    const char* name() const override {
+        return "PartitionedWriterObserver";
+    }
+
+private:
+    // Copies share the descriptors and the byte counter but get empty buffers.
+    PartitionedWriterObserver(const PartitionedWriterObserver& other)
+        : prefix(other.prefix), scheme(other.scheme), format(other.format), min(other.min), width(other.width),
+          files(other.files), written(other.written) {
+        allocate();
+    }
+
+    void allocate() {
+        size_t count = files->fds.size();
+        buffer_size = std::clamp<size_t>((8 << 20) / count, 4096, 1 << 20);
+        buffers.resize(count * buffer_size);
+        used.assign(count, 0);
+    }
+
+    size_t partition(int number) const {
+        size_t count = files->fds.size();
+        if (scheme == Scheme::HASH) {
+            uint32_t hash = static_cast<uint32_t>(number) * 0x9E3779B1u;
+            return (static_cast<uint64_t>(hash) * count) >> 32;
+        }
+        int64_t part = (int64_t(number) - min) / width;
+        return static_cast<size_t>(std::clamp<int64_t>(part, 0, count - 1));
+    }
+
+    void write_block(size_t part) {
+        const char* data = buffers.data() + part * buffer_size;
+        size_t size = used[part];
+        while (size > 0) {
+            ssize_t n = ::write(files->fds[part], data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            *written += n;
+            data += n;
+            size -= n;
+        }
+        used[part] = 0;
+    }
+
+    void flush() {
+        for (size_t part = 0; part < used.size(); ++part) {
+            if (used[part]) write_block(part);
+        }
+    }
+};
+
+// Stable LSD radix sort over the 8-bit digits of the sign-flipped value. Each
+// pass counts digits per thread, turns the histograms into per-thread scatter
+// offsets and scatters the slices in parallel. Passes in which every value has
+// the same digit are skipped, so narrow value ranges need fewer passes.
+void radix_sort(std::vector<int>& values, unsigned threads) {
+    size_t n = values.size();
+    if (n < (1 << 16)) {
+        std::sort(values.begin(), values.end());
+        return;
+    }
+    threads = std::max<size_t>(1, std::min<size_t>(threads, n >> 16));
+    std::vector<int> scratch(n);
+    int* src = values.data();
+    int* dst = scratch.data();
+    std::vector<std::array<size_t, 256>> offsets(threads);
+
+    auto run = [&](auto&& body) {
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t) workers.emplace_back(body, t);
+        body(0u);
+        for (auto& worker : workers) worker.join();
+    };
+
+    for (unsigned shift = 0; shift < 32; shift += 8) {
+        auto digit = [shift](int value) {
+            return ((static_cast<uint32_t>(value) ^ 0x80000000u) >> shift) & 0xFF;
+        };
+        run([&](unsigned t) {
+            auto& counts = offsets[t];
+            counts.fill(0);
+            for (size_t i = n * t / threads, end = n * (t + 1) / threads; i < end; ++i) {
+                ++counts[digit(src[i])];
+            }
+            });
+
+        size_t base = 0;
+        bool trivial = false;
+        for (unsigned d = 0; d < 256; ++d) {
+            size_t bucket = 0;
+            for (unsigned t = 0; t < threads; ++t) {
+                size_t count = offsets[t][d];
+                offsets[t][d] = base + bucket;
+                bucket += count;
+            }
+            trivial |= bucket == n;
+            base += bucket;
+        }
+        if (trivial) continue;
+
+        run([&](unsigned t) {
+            auto& next = offsets[t];
+            for (size_t i = n * t / threads, end = n * (t + 1) / threads; i < end; ++i) {
+                dst[next[digit(src[i])]++] = src[i];
+            }
+            });
+        std::swap(src, dst);
+    }
+    if (src != values.data()) std::memcpy(values.data(), src, n * sizeof(int));
+}
+
+// Collects passing numbers and hands them to sink in ascending order once the
+// input is exhausted, optionally dropping duplicates. Forked lanes share one
+// memory budget; whenever the buffered values exceed it, the lane that crossed
+// it sorts its buffer and spills it as a run to an unlinked temporary file.
+// on_finished either radix-sorts in memory or k-way merges the spilled runs.
+class SortObserver : public INumberObserver {
+    static constexpr size_t batch_size = 4096;
+    static constexpr size_t read_buffer = 1 << 16;
+
+    struct Budget {
+        explicit Budget(size_t limit) : limit(limit) {}
+        size_t limit;
+        std::atomic<size_t> used{ 0 };
+    };
+
+    struct Run {
+        int fd;
+        size_t count;
+    };
+
+    std::unique_ptr<INumberObserver> sink;
+    bool unique;
+    std::shared_ptr<Budget> budget;
+    size_t reserved = 0;
+    std::vector<int> values;
+    std::vector<Run> runs;
+
+    SortObserver(bool unique, std::shared_ptr<Budget> budget)
+        : unique(unique), budget(std::move(budget)) {
+    }
+
+public:
+    SortObserver(std::unique_ptr<INumberObserver> sink, bool unique, size_t memory_budget)
+        : sink(std::move(sink)), unique(unique),
+          budget(std::make_shared<Budget>(std::max<size_t>(memory_budget, 1 << 20))) {
+    }
+
+    ~SortObserver() {
+        for (auto& run : runs) ::close(run.fd);
+    }
+
+    SortObserver(const SortObserver&) = delete;
+    SortObserver& operator=(const SortObserver&) = delete;
+
+    void on_number(int number) override {
+        values.push_back(number);
+        reserve(1);
+    }
+
+    void on_batch(const int* batch, const uint32_t* selection, size_t count) override {
+        size_t size = values.size();
+        values.resize(size + count);
+        for (size_t i = 0; i < count; ++i) {
+            values[size + i] = batch[selection[i]];
+        }
+        reserve(count);
+    }
+
+    bool forkable() const override {
+        return true;
+    }
+
+    std::unique_ptr<INumberObserver> fork() const override {
+        return std::unique_ptr<SortObserver>(new SortObserver(unique, budget));
+    }
+
+    void merge(INumberObserver& other) override {
+        auto& lane = static_cast<SortObserver&>(other);
+        runs.insert(runs.end(), lane.runs.begin(), lane.runs.end());
+        lane.runs.clear();
+        values.insert(values.end(), lane.values.begin(), lane.values.end());
+        std::vector<int>().swap(lane.values);
+        reserved += std::exchange(lane.reserved, 0);
+        if (budget->used > budget->limit) spill(1);
+    }
+
+    void on_finished() override {
+        if (runs.empty()) {
+            radix_sort(values, std::max(1u, std::thread::hardware_concurrency()));
+            if (unique) values.erase(std::unique(values.begin(), values.end()), values.end());
+            for (size_t i = 0; i < values.size(); i += batch_size) {
+                emit(values.data() + i, std::min(batch_size, values.size() - i));
+            }
+        }
+        else {
+            if (!values.empty()) spill(std::max(1u, std::thread::hardware_concurrency()));
+            merge_runs();
+        }
+        std::vector<int>().swap(values);
+        release();
+        if (sink) sink->on_finished();
+    }
+
+    bool order_sensitive() const override {
+        return false;
+    }
+
+    const char* name() const override {
+        return "SortObserver";
+    }
+
+private:
+    // Each copy charges the shared budget for the values it holds and gives
+    // back exactly that amount once they are spilled or emitted.
+    void reserve(size_t count) {
+        size_t bytes = count * sizeof(int);
+        reserved += bytes;
+        if (budget->used.fetch_add(bytes) + bytes > budget->limit) {
+            spill(1);
+        }
+    }
+
+    void release() {
+        budget->used.fetch_sub(reserved);
+        reserved = 0;
+    }
+
+    void spill(unsigned threads) {
+        radix_sort(values, threads);
+        if (unique) values.erase(std::unique(values.begin(), values.end()), values.end());
+        int fd = open_temp_file(std::filesystem::temp_directory_path().string());
+        if (fd < 0 || !write_run(fd)) {
+            if (fd >= 0) ::close(fd);
+            std::cout << "Error: Cannot spill sorted run, keeping it in memory\n";
+            return;
+        }
+        runs.push_back({ fd, values.size() });
+        std::vector<int>().swap(values);
+        release();
+    }
+
+    bool write_run(int fd) {
+        const char* data = reinterpret_cast<const char*>(values.data());
+        size_t size = values.size() * sizeof(int);
+        while (size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    void merge_runs() {
+        struct Cursor {
+            Run run;
+            std::vector<int> buffer;
+            size_t offset = 0;
+            size_t pos = 0;
+            size_t end = 0;
+
+            bool refill() {
+                size_t want = std::min(buffer.size(), run.count - offset);
+                size_t got = 0;
+                while (got < want * sizeof(int)) {
+                    ssize_t n = ::pread(run.fd, reinterpret_cast<char*>(buffer.data()) + got,
+                        want * sizeof(int) - got, offset * sizeof(int) + got);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) break;
+                    got += n;
+                }
+                offset += got / sizeof(int);
+                pos = 0;
+                end = got / sizeof(int);
+                return end > 0;
+            }
+        };
+
+        std::vector<Cursor> cursors;
+        for (const auto& run : runs) cursors.push_back({ run, std::vector<int>(read_buffer) });
+        using Head = std::pair<int, size_t>;
+        std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap;
+        for (size_t i = 0; i < cursors.size(); ++i) {
+            if (cursors[i].refill()) heap.push({ cursors[i].buffer[0], i });
+        }
+
+        int out[batch_size];
+        size_t used = 0;
+        bool first = true;
+        int last = 0;
+        while (!heap.empty()) {
+            auto [value, index] = heap.top();
+            heap.pop();
+            if (!unique || first || value != last) {
+                out[used++] = value;
+                if (used == batch_size) {
+                    emit(out, used);
+                    used = 0;
+                }
+                first = false;
+                last = value;
+            }
+            auto& cursor = cursors[index];
+            if (++cursor.pos < cursor.end || cursor.refill()) {
+                heap.push({ cursor.buffer[cursor.pos], index });
+            }
+        }
+        emit(out, used);
+    }
+
+    void emit(const int* data, size_t count) {
+        if (sink && count > 0) sink->on_batch(data, identity_selection(), count);
+    }
+};
+
+// Passes numbers through to `sink` while keeping a copy, so the passing set
+// can be stored by the result cache. After load_state the stored numbers are
+// replayed into the sink ahead of any new ones.
+class RecordingObserver : public INumberObserver {
+    std::unique_ptr<INumberObserver> sink;
+    std::vector<int> numbers;
+    bool replay = false;
+
+public:
+    explicit RecordingObserver(std::unique_ptr<INumberObserver> sink) : sink(std::move(sink)) {
+    }
+
+    void on_number(int number) override {
+        flush_replay();
+        numbers.push_back(number);
+        sink->on_number(number);
+    }
+
+    void on_batch(const int* values, const uint32_t* selection, size_t count) override {
+        flush_replay();
+        for (size_t i = 0; i < count; ++i) numbers.push_back(values[selection[i]]);
+        sink->on_batch(values, selection, count);
+    }
+
+    bool forkable() const override {
+        return sink->forkable();
+    }
+
+    std::unique_ptr<INumberObserver> fork() const override {
+        auto copy = sink->fork();
+        return copy ? std::make_unique<RecordingObserver>(std::move(copy)) : nullptr;
+    }
+
+    void merge(INumberObserver& other) override {
+        auto& lane = static_cast<RecordingObserver&>(other);
+        flush_replay();
+        numbers.insert(numbers.end(), lane.numbers.begin(), lane.numbers.end());
+        std::vector<int>().swap(lane.numbers);
+        sink->merge(*lane.sink);
+    }
+
+    void on_progress() override {
+        sink->on_progress();
+    }
+
+    bool done() const override {
+        return sink->done();
+    }
+
+    void on_finished() override {
+        flush_replay();
+        sink->on_finished();
+    }
+
+    bool saves_state() const override {
+        return true;
+    }
+
+    bool save_state(std::string& state) const override {
+        state.append(reinterpret_cast<const char*>(numbers.data()), numbers.size() * sizeof(int));
+        return true;
+    }
+
+    bool load_state(std::string_view in) override {
+        if (in.size() % sizeof(int) != 0) return false;
+        numbers.resize(in.size() / sizeof(int));
+        std::memcpy(numbers.data(), in.data(), in.size());
+        replay = true;
+        return true;
+    }
+
+    bool order_sensitive() const override {
+        return sink->order_sensitive();
+    }
+
+    const char* name() const override {
+        return sink->name();
+    }
+
+private:
+    // Loaded numbers reach the sink before any new ones.
+    void flush_replay() {
+        if (!replay) return;
+        replay = false;
+        for (size_t i = 0; i < numbers.size(); i += 4096) {
+            sink->on_batch(numbers.data() + i, identity_selection(), std::min<size_t>(4096, numbers.size() - i));
+        }
+    }
+};
+
+class CountObserver : public INumberObserver {
+    long long count = 0;
+    std::ostream& out;
+    std::string label;
+public:
+    explicit CountObserver(std::ostream& out = std::cout, const std::string& label = "")
+        : out(out), label(label) {
+    }
+
+    void on_number(int number) override {
+        ++count;
+    }
+
+    void on_batch(const int*, const uint32_t*, size_t passed) override {
+        count += passed;
+    }
+
+    void on_finished() override {
+        out << (label.empty() ? "" : "[" + label + "] ") << "Total passed numbers: " << count << "\n";
+    }
+
+    bool forkable() const override {
+        return true;
+    }
+
+    std::unique_ptr<INumberObserver> fork() const override {
+        return std::make_unique<CountObserver>(out, label);
+    }
+
+    void merge(INumberObserver& other) override {
+        count += static_cast<CountObserver&>(other).count;
+    }
+
+    bool saves_state() const override {
+        return true;
+    }
+
+    bool save_state(std::string& out) const override {
+        put_pod(out, count);
+        return true;
+    }
+
+    bool load_state(std::string_view in) override {
+        return get_pod(in, count) && in.empty();
+    }
+
+    void on_progress() override {
+        out << (label.empty() ? "" : "[" + label + "] ") << "Total passed numbers so far: " << count << std::endl;
+    }
+
+    bool order_sensitive() const override {
+        return false;
+    }
+
+    const char* name() const override {
+        return "CountObserver";
+    }
+};
+
+// Answers whether any number passes the query, remembering one example.
+// It is done after the first match, which lets the run stop right there.
+class ExistsObserver : public INumberObserver {
+    std::ostream& out;
+    std::string label;
+    bool found = false;
+    int example = 0;
+
+public:
+    explicit ExistsObserver(std::ostream& out = std::cout, const std::string& label = "")
+        : out(out), label(label) {
+    }
+
+    void on_number(int number) override {
+        if (!found) {
+            found = true;
+            example = number;
+        }
+    }
+
+    void on_batch(const int* values, const uint32_t* selection, size_t count) override {
+        if (count > 0) on_number(values[selection[0]]);
+    }
+
+    bool done() const override {
+        return found;
+    }
+
+    bool forkable() const override {
+        return true;
+    }
+
+    std::unique_ptr<INumberObserver> fork() const override {
+        return std::make_unique<ExistsObserver>(out, label);
+    }
+
+    void merge(INumberObserver& other) override {
+        auto& lane = static_cast<ExistsObserver&>(other);
+        if (!found && lane.found) on_number(lane.example);
+    }
+
+    bool saves_state() const override {
+        return true;
+    }
+
+    bool save_state(std::string& state) const override {
+        put_pod(state, found);
+        put_pod(state, example);
+        return true;
+    }
+
+    bool load_state(std::string_view in) override {
+        bool f;
+        int e;
+        if (!get_pod(in, f) || !get_pod(in, e) || !in.empty()) return false;
+        found = f;
+        example = e;
+        return true;
+    }
+
+    void on_finished() override {
+        out << (label.empty() ? "" : "[" + label + "] ") << "Match found: ";
+        if (found) out << "yes, e.g. " << example << "\n";
+        else out << "no\n";
+    }
+
+    bool order_sensitive() const override {
+        return false;
+    }
+
+    const char* name() const override {
+        return "ExistsObserver";
+    }
+};
+
+// Windowed aggregates over the stream of passing numbers, reported every
+// `every` numbers. Sliding windows cover the last `size` numbers and keep them
+// in a two-stack queue: each stack entry carries the aggregate of itself and
+// everything below it, so push, pop and query are O(1) amortized. Tumbling
+// windows only need a running aggregate that is reset when the window closes.
+// Windows depend on arrival order, so the observer cannot be forked.
+class WindowObserver : public INumberObserver {
+public:
+    enum class Kind { SLIDING, TUMBLING };
+
+private:
+    struct Aggregate {
+        long long count = 0;
+        long long sum = 0;
+        int min = std::numeric_limits<int>::max();
+        int max = std::numeric_limits<int>::min();
+
+        Aggregate& add(const Aggregate& other) {
+            count += other.count;
+            sum += other.sum;
+            min = std::min(min, other.min);
+            max = std::max(max, other.max);
+            return *this;
+        }
+
+        static Aggregate of(int value) {
+            return { 1, value, value, value };
+        }
+    };
+
+    struct Entry {
+        int value;
+        Aggregate total;
+    };
+
+    Kind kind;
+    size_t size;
+    size_t every;
+    std::ostream& out;
+    std::string label;
+    std::vector<Entry> front;
+    std::vector<Entry> back;
+    Aggregate tumbling;
+    long long seen = 0;
+    long long reported = 0;
+
+public:
+    WindowObserver(Kind kind, size_t size, size_t every = 0, std::ostream& out = std::cout, const std::string& label = "")
+        : kind(kind), size(std::max<size_t>(size, 1)), every(every ? every : std::max<size_t>(size, 1)),
+          out(out), label(label) {
+    }
+
+    void on_number(int number) override {
+        ++seen;
+        if (kind == Kind::TUMBLING) {
+            tumbling.add(Aggregate::of(number));
+            if (tumbling.count == static_cast<long long>(size)) {
+                report(tumbling);
+                tumbling = {};
+            }
+            return;
+        }
+
+        Aggregate total = Aggregate::of(number);
+        if (!back.empty()) total.add(back.back().total);
+        back.push_back({ number, total });
+        if (front.size() + back.size() > size) pop_front();
+        if (seen % every == 0) report(window());
+    }
+
+    void on_progress() override {
+        out.flush();
+    }
+
+    void on_finished() override {
+        if (kind == Kind::TUMBLING && tumbling.count > 0) report(tumbling);
+        if (kind == Kind::SLIDING && reported != seen && seen > 0) report(window());
+    }
+
+    const char* name() const override {
+        return "WindowObserver";
+    }
+
+private:
+    void pop_front() {
+        if (front.empty()) {
+            while (!back.empty()) {
+                int value = back.back().value;
+                back.pop_back();
+                Aggregate total = Aggregate::of(value);
+                if (!front.empty()) total.add(front.back().total);
+                front.push_back({ value, total });
+            }
+        }
+        front.pop_back();
+    }
+
+    Aggregate window() const {
+        Aggregate total;
+        if (!front.empty()) total.add(front.back().total);
+        if (!back.empty()) total.add(back.back().total);
+        return total;
+    }
+
+    void report(const Aggregate& window) {
+        reported = seen;
+        out << (label.empty() ? "" : "[" + label + "] ")
+            << "Window " << seen - window.count + 1 << "-" << seen
+            << ": count=" << window.count << " sum=" << window.sum
+            << " min=" << window.min << " max=" << window.max << "\n";
+    }
+};
+
+// Counts and sums passing numbers per bucket. The key is value / width
+// (rounded down), value mod k, or the top `bits` bits of the value's position
+// in the int range. Key ranges of up to 2^20 buckets are counted in directly
+// indexed arrays; wider ones use a linear-probing hash table. Forked lanes keep
+// private tables that merge() only collects; on_finished combines them on all
+// cores, each thread owning a slice of the index range or of the hash space.
+class GroupByObserver : public INumberObserver {
+public:
+    enum class Key { DIV, MOD, HIGH };
+
+private:
+    static constexpr int64_t empty_key = std::numeric_limits<int64_t>::min();
+    static constexpr int64_t direct_limit = 1 << 20;
+
+    struct Cell {
+        int64_t key = empty_key;
+        uint64_t count = 0;
+        int64_t sum = 0;
+    };
+
+    struct Table {
+        std::vector<Cell> cells;
+        size_t used = 0;
+    };
+
+    Key kind;
+    int64_t param;
+    int64_t min_key;
+    int64_t max_key;
+    bool direct;
+    std::ostream& out;
+    std::string label;
+    Table table;
+    std::vector<Table> partials;
+
+public:
+    GroupByObserver(Key kind, int64_t param, std::ostream& out = std::cout, const std::string& label = "")
+        : kind(kind), param(std::max<int64_t>(param, 1)), out(out), label(label) {
+        if (kind == Key::HIGH) this->param = std::min<int64_t>(this->param, 32);
+        min_key = key_of(std::numeric_limits<int>::min());
+        max_key = key_of(std::numeric_limits<int>::max());
+        if (kind == Key::MOD) {
+            min_key = 0;
+            max_key = this->param - 1;
+        }
+        direct = max_key - min_key < direct_limit;
+        if (direct) table.cells.resize(max_key - min_key + 1);
+        else table.cells.resize(1024);
+    }
+
+    void on_number(int number) override {
+        add(table, key_of(number), number);
+    }
+
+    void on_batch(const int* values, const uint32_t* selection, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            int value = values[selection[i]];
+            add(table, key_of(value), value);
+        }
+    }
+
+    bool forkable() const override {
+        return true;
+    }
+
+    std::unique_ptr<INumberObserver> fork() const override {
+        return std::make_unique<GroupByObserver>(kind, param, out, label);
+    }
+
+    void merge(INumberObserver& other) override {
+        partials.push_back(std::move(static_cast<GroupByObserver&>(other).table));
+    }
+
+    // The state is the list of non-empty buckets, so it stays small even for
+    // directly indexed tables.
+    bool saves_state() const override {
+        return true;
+    }
+
+    bool save_state(std::string& state) const override {
+        if (!partials.empty()) return false;
+        for (const auto& cell : table.cells) {
+            if (cell.count) put_pod(state, cell);
+        }
+        return true;
+    }
+
+    bool load_state(std::string_view in) override {
+        if (in.size() % sizeof(Cell) != 0) return false;
+        Table loaded;
+        loaded.cells.resize(direct ? max_key - min_key + 1 : 1024);
+        Cell cell;
+        while (get_pod(in, cell)) {
+            if (cell.key < min_key || cell.key > max_key) return false;
+            add(loaded, cell.key, cell.sum, cell.count);
+        }
+        table = std::move(loaded);
+        partials.clear();
+        return true;
+    }
+
+    void on_finished() override {
+        combine();
+        std::vector<Cell> groups;
+        for (const auto& cell : table.cells) {
+            if (cell.count) groups.push_back(cell);
+        }
+        if (!direct) {
+            std::sort(groups.begin(), groups.end(), [](const Cell& a, const Cell& b) { return a.key < b.key; });
+        }
+        std::string prefix = label.empty() ? "" : "[" + label + "] ";
+        for (const auto& group : groups) {
+            out << prefix << "Group " << describe(group.key)
+                << ": count=" << group.count << " sum=" << group.sum << "\n";
+        }
+        out << prefix << "Total groups: " << groups.size() << "\n";
+    }
+
+    bool order_sensitive() const override {
+        return false;
+    }
+
+    const char* name() const override {
+        return "GroupByObserver";
+    }
+
+private:
+    int64_t key_of(int value) const {
+        switch (kind) {
+        case Key::DIV: {
+            int64_t q = value / param;
+            return q - (value % param < 0);
+        }
+        case Key::MOD: {
+            int64_t r = value % param;
+            return r < 0 ? r + param : r;
+        }
+        case Key::HIGH:
+            return (static_cast<uint32_t>(value) ^ 0x80000000u) >> (32 - param) & ((int64_t(1) << param) - 1);
+        }
+        return 0;
+    }
+
+    std::string describe(int64_t key) const {
+        if (kind == Key::MOD) return "mod " + std::to_string(param) + " = " + std::to_string(key);
+        int64_t lo, hi;
+        if (kind == Key::DIV) {
+            lo = std::max<int64_t>(key * param, std::numeric_limits<int>::min());
+            hi = std::min<int64_t>(key * param + param - 1, std::numeric_limits<int>::max());
+        }
+        else {
+            lo = (key << (32 - param)) - (int64_t(1) << 31);
+            hi = lo + (int64_t(1) << (32 - param)) - 1;
+        }
+        return "[" + std::to_string(lo) + ", " + std::to_string(hi) + "]";
+    }
+
+    static uint64_t hash(int64_t key) {
+        return static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull;
+    }
+
+    void add(Table& target, int64_t key, int64_t value, uint64_t count = 1) {
+        Cell* cell;
+        if (direct) {
+            cell = &target.cells[key - min_key];
+        }
+        else {
+            if (2 * (target.used + 1) > target.cells.size()) grow(target);
+            cell = &probe(target, key);
+            if (cell->key == empty_key) ++target.used;
+        }
+        cell->key = key;
+        cell->count += count;
+        cell->sum += value;
+    }
+
+    static Cell& probe(Table& target, int64_t key) {
+        size_t mask = target.cells.size() - 1;
+        size_t i = hash(key) >> 32 & mask;
+        while (target.cells[i].key != empty_key && target.cells[i].key != key) i = (i + 1) & mask;
+        return target.cells[i];
+    }
+
+    static void grow(Table& target) {
+        std::vector<Cell> old(target.cells.size() * 2);
+        old.swap(target.cells);
+        for (const auto& cell : old) {
+            if (cell.key != empty_key) probe(target, cell.key) = cell;
+        }
+    }
+
+    void combine() {
+        if (partials.empty()) return;
+        partials.push_back(std::move(table));
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<Table> shards(threads);
+        if (direct) table.cells.resize(max_key - min_key + 1);
+
+        auto work = [&](unsigned t) {
+            if (direct) {
+                size_t begin = table.cells.size() * t / threads;
+                size_t end = table.cells.size() * (t + 1) / threads;
+                for (const auto& partial : partials) {
+                    for (size_t i = begin; i < end; ++i) {
+                        const Cell& cell = partial.cells[i];
+                        if (!cell.count) continue;
+                        table.cells[i].key = cell.key;
+                        table.cells[i].count += cell.count;
+                        table.cells[i].sum += cell.sum;
+                    }
+                }
+                return;
+            }
+            Table& shard = shards[t];
+            shard.cells.resize(1024);
+            for (const auto& partial : partials) {
+                for (const auto& cell : partial.cells) {
+                    if (cell.key == empty_key || hash(cell.key) % threads != t) continue;
+                    add(shard, cell.key, cell.sum, cell.count);
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t) workers.emplace_back(work, t);
+        work(0);
+        for (auto& worker : workers) worker.join();
+        partials.clear();
+
+        if (!direct) {
+            table = {};
+            for (auto& shard : shards) {
+                for (const auto& cell : shard.cells) {
+                    if (cell.key != empty_key) table.cells.push_back(cell);
+                }
+            }
+        }
+    }
+};
+
+// Thread pool with one deque per worker. Workers pop their own newest task and,
+// when idle, steal the oldest task of a randomly chosen victim. Tasks receive
+// the index of the worker running them so callers can keep per-worker state.
+class WorkStealingPool {
+public:
+    using Task = std::function<void(unsigned)>;
+
+private:
+    struct Queue {
+        std::mutex m;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> pending{ 0 };
+    std::atomic<unsigned> next_queue{ 0 };
+    bool stopping = false;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+
+    static thread_local WorkStealingPool* current_pool;
+    static thread_local unsigned current_worker;
+
+public:
+    explicit WorkStealingPool(unsigned workers) {
+        workers = std::max(1u, workers);
+        for (unsigned i = 0; i < workers; ++i) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (unsigned i = 0; i < workers; ++i) {
+            threads.emplace_back([this, i] { worker_loop(i); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    unsigned size() const {
+        return static_cast<unsigned>(queues.size());
+    }
+
+    void submit(Task task) {
+        unsigned target = current_pool == this ? current_worker : next_queue++ % size();
+        ++pending;
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->m);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        wake.notify_one();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        idle.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    bool pop_local(unsigned self, Task& task) {
+        auto& q = *queues[self];
+        std::lock_guard<std::mutex> lock(q.m);
+        if (q.tasks.empty()) return false;
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(unsigned self, std::minstd_rand& rng, Task& task) {
+        unsigned n = size();
+        unsigned start = rng() % n;
+        for (unsigned k = 0; k < n; ++k) {
+            unsigned victim = (start + k) % n;
+            if (victim == self) continue;
+            auto& q = *queues[victim];
+            std::lock_guard<std::mutex> lock(q.m);
+            if (q.tasks.empty()) continue;
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void worker_loop(unsigned self) {
+        current_pool = this;
+        current_worker = self;
+        std::minstd_rand rng(self + 1);
+        while (true) {
+            Task task;
+            if (pop_local(self, task) || steal(self, rng, task)) {
+                task(self);
+                if (--pending == 0) {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    idle.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            if (stopping) return;
+            wake.wait_for(lock, std::chrono::milliseconds(1));
+        }
+    }
+};
+
+thread_local WorkStealingPool* WorkStealingPool::current_pool = nullptr;
+thread_local unsigned WorkStealingPool::current_worker = 0;
+
+// Lock-free single-producer/single-consumer ring. push() waits while the ring
+// is full, which is what gives the pipeline its backpressure. A waiting side
+// spins briefly and then sleeps on `epoch`, which every push, pop and close
+// advances, so stalled and idle stages do not burn CPU.
+template <typename T>
+class SpscQueue {
+    static constexpr int spin_limit = 64;
+
+    std::vector<T> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{ 0 };
+    alignas(64) std::atomic<size_t> tail{ 0 };
+    std::atomic<bool> closed{ false };
+    alignas(64) std::atomic<uint32_t> epoch{ 0 };
+    std::atomic<int> sleepers{ 0 };
+
+public:
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    void push(T value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        wait_until([&] { return t - head.load(std::memory_order_acquire) < slots.size(); });
+        slots[t & mask] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        wake();
+    }
+
+    bool pop(T& out) {
+        size_t h = head.load(std::memory_order_relaxed);
+        wait_until([&] { return h != tail.load(std::memory_order_acquire) || closed.load(std::memory_order_acquire); });
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        out = std::move(slots[h & mask]);
+        slots[h & mask] = T();
+        head.store(h + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    void close() {
+        closed.store(true, std::memory_order_release);
+        wake();
+    }
+
+private:
+    template <typename Ready>
+    void wait_until(Ready ready) {
+        for (int spin = 0; spin < spin_limit; ++spin) {
+            if (ready()) return;
+            std::this_thread::yield();
+        }
+        while (!ready()) {
+            // Registering before reading the epoch means a wake() that does
+            // not see this sleeper advanced the epoch before it was read, so
+            // the recheck below sees its update.
+            sleepers.fetch_add(1);
+            uint32_t seen = epoch.load();
+            if (!ready()) epoch.wait(seen);
+            sleepers.fetch_sub(1);
+        }
+    }
+
+    void wake() {
+        epoch.fetch_add(1);
+        if (sleepers.load()) epoch.notify_all();
+    }
+};
+
+// One filter together with the observers that receive what it passes.
+struct Query {
+    INumberFilter* filter;
+    std::vector<INumberObserver*> observers;
+    size_t limit = 0; // at most this many passing numbers reach the observers; 0 is unlimited
+};
+
+// One batch of values with the selection of every query over it.
+struct FilteredBatch {
+    std::span<const int> values;
+    std::vector<std::span<const uint32_t>> selections;
+};
+
+// Runs every query's filter over each batch as it is pulled.
+Generator<FilteredBatch> lazy_filter(Generator<std::span<const int>> batches, const std::vector<Query>& queries, PipelineStats* stats) {
+    std::vector<std::vector<uint32_t>> selections(queries.size());
+    FilteredBatch filtered;
+    for (std::span<const int> batch : batches) {
+        filtered.values = batch;
+        filtered.selections.clear();
+        if (stats) stats->numbers_in += batch.size();
+        for (size_t i = 0; i < queries.size(); ++i) {
+            selections[i].resize(std::max(selections[i].size(), batch.size()));
+            size_t passed;
+            {
+                StageTimer timer(stat(stats, &PipelineStats::filter_ns));
+                passed = queries[i].filter->select(batch.data(), batch.size(), selections[i].data());
+            }
+            if (stats) stats->numbers_out += passed;
+            filtered.selections.emplace_back(selections[i].data(), passed);
+        }
+        co_yield filtered;
+    }
+}
+
+class NumberProcessor {
+    INumberReader& reader;
+    std::vector<Query> queries;
+    bool incremental = false;
+    bool pipelined = false;
+    bool lazy = false;
+    bool split = false;
+    PipelineStats* stats = nullptr;
+    std::map<std::string, std::pair<size_t, size_t>> ranges;
+
+    // Per-query LIMIT budget and completion; `cancel` is raised once every
+    // query is finished and tells readers and queued chunks to stop.
+    static constexpr size_t unlimited = SIZE_MAX;
+    std::vector<std::atomic<size_t>> remaining;
+    std::vector<std::atomic<bool>> finished;
+    std::atomic<size_t> open_queries{ 0 };
+    std::atomic<bool> cancel{ false };
+
+public:
+    NumberProcessor(INumberReader& r, INumberFilter& f, const std::vector<INumberObserver*>& obs)
+        : reader(r), queries{ Query{ &f, obs } } {
+    }
+
+    // Several queries share a single read and parse of every input.
+    NumberProcessor(INumberReader& r, std::vector<Query> q)
+        : reader(r), queries(std::move(q)) {
+    }
+
+    void set_incremental(bool enabled) {
+        incremental = enabled;
+    }
+
+    void set_pipelined(bool enabled) {
+        pipelined = enabled;
+    }
+
+    void set_lazy(bool enabled) {
+        lazy = enabled;
+    }
+
+    // Limits a text input to the bytes [begin, end), which are then parsed in
+    // chunks like the parallel path does. `begin` must start a token.
+    void set_range(const std::string& file, size_t begin, size_t end) {
+        ranges[file] = { begin, end };
+    }
+
+    void set_stats(PipelineStats* s) {
+        stats = s;
+        reader.set_stats(s);
+        if (stats) {
+            stats->queries = queries.size();
+            for (const auto& query : queries) {
+                for (auto* obs : query.observers) stats->add_observer(obs->name());
+            }
+        }
+    }
+
+    void run(const std::string& filename) {
+        run(std::vector<std::string>{ filename }, 1);
+    }
+
+    void run(std::vector<std::string> files, unsigned jobs) {
+        // One file is split into chunks only when no result depends on the
+        // order numbers arrive in; otherwise workers take whole files.
+        split = true;
+        for (const auto& query : queries) {
+            if (query.limit) split = false;
+            for (auto* obs : query.observers) {
+                if (obs->order_sensitive()) split = false;
+            }
+        }
+        bool parallel = jobs > 1 && (files.size() > 1 || split);
+        for (const auto& query : queries) {
+            for (auto* obs : query.observers) {
+                if (!obs->forkable()) parallel = false;
+            }
+        }
+
+        remaining = std::vector<std::atomic<size_t>>(queries.size());
+        finished = std::vector<std::atomic<bool>>(queries.size());
+        for (size_t i = 0; i < queries.size(); ++i) {
+            remaining[i] = queries[i].limit ? queries[i].limit : unlimited;
+        }
+        open_queries = queries.size();
+        cancel = false;
+        reader.set_cancel(&cancel);
+
+        uint64_t start = now_ns();
+        if (lazy) {
+            run_lazy(files);
+        }
+        else if (pipelined) {
+            run_pipelined(files);
+        }
+        else if (!parallel) {
+            for (const auto& file : files) {
+                if (cancel) break;
+                process(file, queries);
+            }
+        }
+        else {
+            run_parallel(files, jobs);
+        }
+        reader.set_cancel(nullptr);
+
+        for (const auto& query : queries) {
+            for (auto* obs : query.observers) {
+                obs->on_finished();
+            }
+        }
+        if (stats) stats->wall_ns += now_ns() - start;
+    }
+
+private:
+    static constexpr size_t chunk_bytes = 1 << 20;
+    static constexpr size_t slice_numbers = 1 << 14;
+    static constexpr size_t batch_numbers = 4096;
+
+    // Takes up to `passed` numbers from query q's LIMIT budget and returns how
+    // many may be delivered. Lanes draw from the same budget, so the total is
+    // exact; with several jobs which matches are delivered is unspecified.
+    size_t admit(size_t q, size_t passed) {
+        if (finished[q]) return 0;
+        size_t left = remaining[q].load();
+        while (left != unlimited) {
+            size_t take = std::min(left, passed);
+            if (remaining[q].compare_exchange_weak(left, left - take)) {
+                if (take == left) finish(q);
+                return take;
+            }
+        }
+        return passed;
+    }
+
+    void finish(size_t q) {
+        if (!finished[q].exchange(true) && --open_queries == 0) cancel = true;
+    }
+
+    void check_done(size_t q, const Query& query) {
+        for (auto* obs : query.observers) {
+            if (obs->done()) finish(q);
+        }
+    }
+
+    // Private copies of every filter and observer for one worker.
+    struct Lane {
+        std::vector<std::unique_ptr<INumberFilter>> filters;
+        std::vector<std::unique_ptr<INumberObserver>> observers;
+        std::vector<Query> queries;
+    };
+
+    Lane fork_lane() const {
+        Lane lane;
+        for (const auto& query : queries) {
+            lane.filters.push_back(query.filter->clone());
+            Query copy{ lane.filters.back().get(), {} };
+            for (auto* obs : query.observers) {
+                lane.observers.push_back(obs->fork());
+                copy.observers.push_back(lane.observers.back().get());
+            }
+            lane.queries.push_back(std::move(copy));
+        }
+        return lane;
+    }
+
+    void merge_lane(Lane& lane) {
+        for (size_t q = 0; q < queries.size(); ++q) {
+            for (size_t i = 0; i < queries[q].observers.size(); ++i) {
+                queries[q].observers[i]->merge(*lane.queries[q].observers[i]);
+            }
+        }
+    }
+
+    // Parsed chunks of one file reach the observers in file order, and nothing
+    // after the first malformed token does, as when the file is read whole.
+    struct ChunkSequence {
+        std::mutex m;
+        std::vector<std::shared_ptr<std::vector<int>>> parsed;
+        std::vector<char> stopped;
+        size_t next = 0;
+        std::atomic<bool> ended{ false };
+    };
+
+    // Files are queued largest-first. When splitting is allowed, splittable
+    // files fan out into chunk tasks, and each parsed chunk into filter/observe
+    // slices, so idle workers can steal the dense parts of skewed inputs.
+    void run_parallel(std::vector<std::string> files, unsigned jobs) {
+        sort_largest_first(files);
+        WorkStealingPool pool(jobs);
+
+        std::vector<Lane> lanes;
+        for (unsigned w = 0; w < pool.size(); ++w) {
+            lanes.push_back(fork_lane());
+        }
+
+        std::vector<std::unique_ptr<MappedFile>> mapped;
+        std::vector<std::unique_ptr<ChunkSequence>> sequences;
+        for (const auto& file : files) {
+            if (!split || !reader.splittable(file)) {
+                pool.submit([&, file](unsigned w) {
+                    if (!cancel) process(file, lanes[w].queries);
+                    });
+                continue;
+            }
+            mapped.push_back(std::make_unique<MappedFile>(file));
+            const MappedFile& map = *mapped.back();
+            if (!map.valid()) continue;
+
+            const char* begin = map.data();
+            const char* end = begin + map.size();
+            if (auto range = ranges.find(file); range != ranges.end()) {
+                end = map.data() + std::min(range->second.second, map.size());
+                begin = std::min(end, map.data() + range->second.first);
+            }
+            std::vector<std::pair<const char*, const char*>> chunks;
+            while (begin < end) {
+                const char* cut = begin + std::min<size_t>(chunk_bytes, end - begin);
+                while (cut < end && !std::isspace(static_cast<unsigned char>(*cut))) ++cut;
+                chunks.emplace_back(begin, cut);
+                begin = cut;
+            }
+            sequences.push_back(std::make_unique<ChunkSequence>());
+            ChunkSequence* sequence = sequences.back().get();
+            sequence->parsed.resize(chunks.size());
+            sequence->stopped.resize(chunks.size());
+            for (size_t index = 0; index < chunks.size(); ++index) {
+                auto [from, to] = chunks[index];
+                pool.submit([&, sequence, index, from, to](unsigned) {
+                    if (cancel || sequence->ended) return;
+                    auto numbers = std::make_shared<std::vector<int>>();
+                    bool stopped;
+                    {
+                        StageTimer timer(stat(stats, &PipelineStats::parse_ns));
+                        stopped = parse_numbers(from, to, true, *numbers).stopped;
+                    }
+                    if (stats) stats->bytes += to - from;
+                    deliver(pool, *sequence, index, std::move(numbers), stopped, lanes);
+                    });
+            }
+        }
+        pool.wait();
+
+        for (auto& lane : lanes) {
+            merge_lane(lane);
+        }
+    }
+
+    // Records a parsed chunk and submits every chunk that is now next in file
+    // order as filter/observe slices.
+    void deliver(WorkStealingPool& pool, ChunkSequence& sequence, size_t index,
+        std::shared_ptr<std::vector<int>> numbers, bool stopped, std::vector<Lane>& lanes) {
+        std::lock_guard<std::mutex> lock(sequence.m);
+        sequence.parsed[index] = std::move(numbers);
+        sequence.stopped[index] = stopped;
+        while (!sequence.ended && sequence.next < sequence.parsed.size() && sequence.parsed[sequence.next]) {
+            auto ready = std::move(sequence.parsed[sequence.next]);
+            if (sequence.stopped[sequence.next++]) sequence.ended = true;
+            for (size_t from = 0; from < ready->size(); from += slice_numbers) {
+                size_t to = std::min(ready->size(), from + slice_numbers);
+                pool.submit([&, ready, from, to](unsigned w) {
+                    if (cancel) return;
+                    observe(ready->data() + from, ready->data() + to, lanes[w].queries);
+                    });
+            }
+        }
+    }
+
+    struct ByteChunk {
+        std::vector<char> data;
+        std::vector<int> numbers;
+        bool end_of_file = false;
+    };
+    using Batch = std::shared_ptr<const std::vector<int>>;
+
+    // Read, parse, filter and every observer run on their own thread, linked
+    // by SPSC rings of batches. Inputs that are not raw text are decoded by
+    // the reader in the first stage and passed through the parse stage.
+    void run_pipelined(const std::vector<std::string>& files) {
+        constexpr size_t depth = 16;
+        SpscQueue<ByteChunk> bytes(depth);
+        SpscQueue<Batch> parsed(depth);
+        std::vector<std::unique_ptr<SpscQueue<Batch>>> passed;
+        std::vector<INumberObserver*> sinks;
+        for (const auto& query : queries) {
+            for (auto* obs : query.observers) {
+                passed.push_back(std::make_unique<SpscQueue<Batch>>(depth));
+                sinks.push_back(obs);
+            }
+        }
+
+        std::vector<std::thread> stages;
+        stages.emplace_back([&] {
+            for (const auto& file : files) {
+                if (cancel) break;
+                if (!reader.reads_text(file)) {
+                    reader.read_batches(file, [&](const std::vector<int>& batch) {
+                        ByteChunk chunk;
+                        chunk.numbers = batch;
+                        bytes.push(std::move(chunk));
+                        });
+                    continue;
+                }
+                int fd = open_input(file);
+                if (fd < 0) continue;
+                while (true) {
+                    ByteChunk chunk;
+                    chunk.data.resize(1 << 20);
+                    ssize_t got;
+                    {
+                        StageTimer timer(stat(stats, &PipelineStats::read_ns));
+                        got = ::read(fd, chunk.data.data(), chunk.data.size());
+                    }
+                    if (got < 0 && errno == EINTR) continue;
+                    if (stats && got > 0) stats->bytes += got;
+                    chunk.data.resize(got > 0 ? got : 0);
+                    chunk.end_of_file = got <= 0;
+                    bytes.push(std::move(chunk));
+                    if (got <= 0 || cancel) break;
+                }
+                if (fd != STDIN_FILENO) ::close(fd);
+            }
+            bytes.close();
+            });
+
+        stages.emplace_back([&] {
+            auto parser = std::make_unique<ChunkParser>();
+            ByteChunk chunk;
+            while (bytes.pop(chunk)) {
+                if (!chunk.numbers.empty()) {
+                    parsed.push(std::make_shared<const std::vector<int>>(std::move(chunk.numbers)));
+                    continue;
+                }
+                auto batch = std::make_shared<std::vector<int>>();
+                {
+                    StageTimer timer(stat(stats, &PipelineStats::parse_ns));
+                    parser->feed(chunk.data.data(), chunk.data.size(), *batch);
+                    if (chunk.end_of_file) {
+                        parser->finish(*batch);
+                        parser = std::make_unique<ChunkParser>();
+                    }
+                }
+                if (!batch->empty()) parsed.push(std::move(batch));
+            }
+            parsed.close();
+            });
+
+        stages.emplace_back([&] {
+            Batch batch;
+            std::vector<uint32_t> selection;
+            while (parsed.pop(batch)) {
+                if (stats) stats->numbers_in += batch->size();
+                size_t queue = 0;
+                for (size_t q = 0; q < queries.size(); ++q) {
+                    const auto& query = queries[q];
+                    if (finished[q]) {
+                        queue += query.observers.size();
+                        continue;
+                    }
+                    auto kept = std::make_shared<std::vector<int>>();
+                    {
+                        StageTimer timer(stat(stats, &PipelineStats::filter_ns));
+                        selection.resize(batch->size());
+                        size_t passed = query.filter->select(batch->data(), batch->size(), selection.data());
+                        kept->resize(admit(q, passed));
+                        for (size_t i = 0; i < kept->size(); ++i) (*kept)[i] = (*batch)[selection[i]];
+                    }
+                    if (stats) stats->numbers_out += kept->size();
+                    Batch shared = std::move(kept);
+                    for (size_t i = 0; i < query.observers.size(); ++i) passed[queue++]->push(shared);
+                }
+            }
+            for (auto& queue : passed) queue->close();
+            });
+
+        for (size_t i = 0, q = 0, first = 0; i < sinks.size(); ++i) {
+            while (i - first >= queries[q].observers.size()) first += queries[q++].observers.size();
+            stages.emplace_back([&, i, q] {
+                Batch batch;
+                while (passed[i]->pop(batch)) {
+                    StageTimer timer(stats ? &stats->observer_ns[i] : nullptr);
+                    for (int n : *batch) sinks[i]->on_number(n);
+                    if (incremental) sinks[i]->on_progress();
+                    if (sinks[i]->done()) finish(q);
+                }
+                });
+        }
+
+        for (auto& stage : stages) stage.join();
+    }
+
+    // Pulls batches through lazy read, parse and filter stages. Nothing is read
+    // ahead of the batch the observers are consuming. Inputs the reader does not
+    // treat as text (compressed files) go through the regular batch path.
+    void run_lazy(const std::vector<std::string>& files) {
+        for (const auto& file : files) {
+            if (!reader.reads_text(file)) {
+                process(file, queries);
+                continue;
+            }
+            for (const FilteredBatch& batch : lazy_filter(lazy_parse(lazy_chunks(file, stats), stats), queries, stats)) {
+                size_t index = 0;
+                for (size_t q = 0; q < queries.size(); ++q) {
+                    size_t passed = admit(q, batch.selections[q].size());
+                    for (auto* obs : queries[q].observers) {
+                        StageTimer timer(stats ? &stats->observer_ns[index++] : nullptr);
+                        obs->on_batch(batch.values.data(), batch.selections[q].data(), passed);
+                    }
+                    check_done(q, queries[q]);
+                }
+                if (cancel) break;
+            }
+            if (cancel) break;
+        }
+    }
+
+    // Each batch is filtered into a selection vector of passing indices, then
+    // every observer of the query consumes the dense values together with the
+    // selection. All queries see the batch while it is still in cache.
+    void observe(const int* begin, const int* end, const std::vector<Query>& targets) {
+        thread_local std::vector<uint32_t> selection(batch_numbers);
+        for (const int* p = begin; p < end && !cancel; p += batch_numbers) {
+            size_t count = std::min<size_t>(batch_numbers, end - p);
+            if (stats) stats->numbers_in += count;
+            size_t index = 0;
+            for (size_t q = 0; q < targets.size(); ++q) {
+                const auto& query = targets[q];
+                if (finished[q]) {
+                    index += query.observers.size();
+                    continue;
+                }
+                size_t passed;
+                {
+                    StageTimer timer(stat(stats, &PipelineStats::filter_ns));
+                    passed = query.filter->select(p, count, selection.data());
+                }
+                passed = admit(q, passed);
+                if (stats) stats->numbers_out += passed;
+                for (auto* obs : query.observers) {
+                    StageTimer timer(stats ? &stats->observer_ns[index++] : nullptr);
+                    obs->on_batch(p, selection.data(), passed);
+                }
+                check_done(q, query);
+            }
+        }
+    }
+
+    void process(const std::string& filename, const std::vector<Query>& targets) {
+        if (auto range = ranges.find(filename); range != ranges.end()) {
+            process_range(filename, range->second.first, range->second.second, targets);
+            return;
+        }
+        reader.read_batches(filename, [&](const std::vector<int>& numbers) {
+            observe(numbers.data(), numbers.data() + numbers.size(), targets);
+            if (incremental) {
+                for (const auto& query : targets) {
+                    for (auto* obs : query.observers) {
+                        obs->on_progress();
+                    }
+                }
+            }
+            });
+    }
+
+    void process_range(const std::string& filename, size_t from, size_t to, const std::vector<Query>& targets) {
+        MappedFile map(filename);
+        if (!map.valid()) return;
+        const char* end = map.data() + std::min(to, map.size());
+        const char* begin = std::min(end, map.data() + from);
+        std::vector<int> numbers;
+        bool stopped = false;
+        while (begin < end && !stopped && !cancel) {
+            const char* cut = begin + std::min<size_t>(chunk_bytes, end - begin);
+            while (cut < end && !std::isspace(static_cast<unsigned char>(*cut))) ++cut;
+            numbers.clear();
+            {
+                StageTimer timer(stat(stats, &PipelineStats::parse_ns));
+                stopped = parse_numbers(begin, cut, true, numbers).stopped;
+            }
+            if (stats) stats->bytes += cut - begin;
+            observe(numbers.data(), numbers.data() + numbers.size(), targets);
+            begin = cut;
+        }
+    }
+
+    static void sort_largest_first(std::vector<std::string>& files) {
+        std::vector<std::pair<std::uintmax_t, std::string>> sized;
+        for (auto& file : files) {
+            std::error_code ec;
+            auto size = std::filesystem::file_size(file, ec);
+            sized.emplace_back(ec ? 0 : size, std::move(file));
+        }
+        std::stable_sort(sized.begin(), sized.end(), [](const auto& a, const auto& b) {
+            return a.first > b.first;
+        });
+        files.clear();
+        for (auto& [size, file] : sized) files.push_back(std::move(file));
+    }
+};
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) hash = (hash ^ p[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+// Canonical spelling of a filter expression: no whitespace, and conjunction
+// terms sorted, since their order does not change the result.
+std::string normalize_filter(const std::string& name) {
+    std::vector<std::string> terms(1);
+    for (char c : name) {
+        if (c == '&') terms.emplace_back();
+        else if (!std::isspace(static_cast<unsigned char>(c))) terms.back() += c;
+    }
+    std::sort(terms.begin(), terms.end());
+    std::string normalized;
+    for (const auto& term : terms) normalized += (normalized.empty() ? "" : "&") + term;
+    return normalized;
+}
+
+// Appends the state of every observer of `queries` as length-prefixed blobs.
+bool save_observer_states(const std::vector<Query>& queries, std::string& out) {
+    for (const auto& query : queries) {
+        for (auto* obs : query.observers) {
+            std::string state;
+            if (!obs->save_state(state)) return false;
+            put_pod(out, static_cast<uint64_t>(state.size()));
+            out += state;
+        }
+    }
+    return true;
+}
+
+// Loads blobs written by save_observer_states. The current states are kept
+// and put back if any blob is rejected, so a bad blob cannot leave the
+// observers half loaded.
+bool load_observer_states(const std::vector<Query>& queries, std::string_view in) {
+    std::vector<std::string_view> states;
+    for (const auto& query : queries) {
+        for (size_t i = 0; i < query.observers.size(); ++i) {
+            uint64_t size;
+            if (!get_pod(in, size) || size > in.size()) return false;
+            states.push_back(in.substr(0, size));
+            in.remove_prefix(size);
+        }
+    }
+    if (!in.empty()) return false;
+
+    std::vector<INumberObserver*> loaded;
+    std::vector<std::string> previous;
+    size_t index = 0;
+    for (const auto& query : queries) {
+        for (auto* obs : query.observers) {
+            previous.emplace_back();
+            if (!obs->save_state(previous.back()) || !obs->load_state(states[index++])) {
+                for (size_t i = 0; i < loaded.size(); ++i) loaded[i]->load_state(previous[i]);
+                return false;
+            }
+            loaded.push_back(obs);
+        }
+    }
+    return true;
+}
+
+// True when every observer can persist its state.
+bool persistable(const std::vector<Query>& queries) {
+    for (const auto& query : queries) {
+        for (auto* obs : query.observers) {
+            if (!obs->saves_state()) return false;
+        }
+    }
+    return true;
+}
+
+// Hashes sixteen evenly spaced 4 KiB blocks of the first `size` bytes of fd.
+uint64_t sample_hash(int fd, off_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+    constexpr size_t blocks = 16;
+    char block[4096];
+    off_t span = std::max<off_t>(size - off_t(sizeof(block)), 0);
+    for (size_t i = 0; i < blocks; ++i) {
+        off_t offset = span * i / (blocks - 1);
+        ssize_t got = ::pread(fd, block, std::min<off_t>(sizeof(block), size - offset), offset);
+        if (got > 0) hash = fnv1a(hash, block, got);
+    }
+    return hash;
+}
+
+// Stores the state of every observer of a run on disk. The entry name hashes
+// each input's device, inode, size, mtime and a sample of its blocks together
+// with a description of the queries, so a changed input or query simply
+// misses. Names start with a hash of just the queries and input paths, and
+// storing an entry removes the others with that prefix, so each query over
+// the same inputs keeps one entry however often the inputs change. Only runs
+// whose observers can all be forked and save their state are cached.
+class ResultCache {
+    static constexpr char magic[4] = { 'N', 'P', 'Q', 'C' };
+
+    std::string dir;
+    std::string prefix;
+    std::string path;
+    uint64_t key = 0xcbf29ce484222325ull;
+
+public:
+    ResultCache(const std::string& dir, const std::vector<std::string>& files, const std::string& tag) : dir(dir) {
+        key = fnv1a(key, tag.data(), tag.size());
+        uint64_t slot = key;
+        for (const auto& file : files) {
+            slot = fnv1a(slot, file.data(), file.size() + 1);
+            if (!fingerprint(file)) return;
+        }
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        char name[48];
+        std::snprintf(name, sizeof(name), "%016llx-", static_cast<unsigned long long>(slot));
+        prefix = name;
+        std::snprintf(name, sizeof(name), "%016llx.qc", static_cast<unsigned long long>(key));
+        path = dir + "/" + prefix + name;
+    }
+
+    bool load(const std::vector<Query>& queries) const {
+        if (path.empty() || !persistable(queries)) return false;
+        std::ifstream in(path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::string_view view(data);
+        if (view.size() < sizeof(magic) || view.compare(0, sizeof(magic), std::string_view(magic, sizeof(magic))) != 0) return false;
+        view.remove_prefix(sizeof(magic));
+
+        uint64_t stored_key;
+        if (!get_pod(view, stored_key) || stored_key != key) return false;
+        return load_observer_states(queries, view);
+    }
+
+    void store(const std::vector<Query>& queries) const {
+        if (path.empty() || !persistable(queries)) return;
+        std::string data(magic, sizeof(magic));
+        put_pod(data, key);
+        if (!save_observer_states(queries, data)) return;
+        std::string temp = path + ".tmp" + std::to_string(::getpid());
+        std::ofstream(temp, std::ios::binary).write(data.data(), data.size());
+        std::error_code ec;
+        std::filesystem::rename(temp, path, ec);
+        if (ec) {
+            std::filesystem::remove(temp, ec);
+            return;
+        }
+        evict_stale();
+    }
+
+private:
+    // Removes entries for earlier versions of the same inputs.
+    void evict_stale() const {
+        std::error_code ec;
+        std::string current = std::filesystem::path(path).filename().string();
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            std::string name = entry.path().filename().string();
+            if (name != current && name.starts_with(prefix) && name.ends_with(".qc")) {
+                std::filesystem::remove(entry.path(), ec);
+            }
+        }
+    }
+
+    bool fingerprint(const std::string& file) {
+        struct stat st{};
+        int fd = file == "-" ? -1 : ::open(file.c_str(), O_RDONLY);
+        if (fd < 0 || ::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            if (fd >= 0) ::close(fd);
+            path.clear();
+            return false;
+        }
+        key = fnv1a(key, file.data(), file.size());
+        for (auto field : { uint64_t(st.st_dev), uint64_t(st.st_ino), uint64_t(st.st_size),
+                 uint64_t(st.st_mtim.tv_sec), uint64_t(st.st_mtim.tv_nsec) }) {
+            key = fnv1a(key, &field, sizeof(field));
+        }
+        key = sample_hash(fd, st.st_size, key);
+        ::close(fd);
+        return true;
+    }
+};
+
+// Byte offset just past the last whitespace of a file: a number at the very
+// end without a trailing separator may still be in the middle of an append.
+size_t complete_prefix(const std::string& file) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    struct stat st{};
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        return 0;
+    }
+    char block[4096];
+    off_t end = st.st_size;
+    while (end > 0) {
+        off_t from = std::max<off_t>(end - off_t(sizeof(block)), 0);
+        ssize_t got = ::pread(fd, block, end - from, from);
+        if (got <= 0) break;
+        for (ssize_t i = got; i > 0; --i) {
+            if (std::isspace(static_cast<unsigned char>(block[i - 1]))) {
+                ::close(fd);
+                return from + i;
+            }
+        }
+        end = from;
+    }
+    ::close(fd);
+    return 0;
+}
+
+// Remembers how far each append-only input was processed and the observers'
+// state at that point. A later run restores the state and only processes the
+// bytes appended since, provided every input is still the same file (device
+// and inode) and its already processed prefix still hashes the same.
+class Checkpoint {
+    static constexpr char magic[4] = { 'N', 'P', 'C', 'K' };
+
+    std::string path;
+    uint64_t tag;
+
+public:
+    Checkpoint(const std::string& path, const std::string& tag)
+        : path(path), tag(fnv1a(0xcbf29ce484222325ull, tag.data(), tag.size())) {
+    }
+
+    // Returns the offset to resume each input from and loads the saved
+    // observer state, or returns no offsets when processing must start over.
+    std::map<std::string, size_t> resume(const std::vector<std::string>& files, const std::vector<Query>& queries) const {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return {};
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::string_view view(data);
+        uint64_t stored_tag = 0, count = 0;
+        bool valid = view.size() >= sizeof(magic) && view.compare(0, sizeof(magic), std::string_view(magic, sizeof(magic))) == 0;
+        if (valid) view.remove_prefix(sizeof(magic));
+        if (!valid || !get_pod(view, stored_tag) || stored_tag != tag || !get_pod(view, count)) {
+            std::cout << "Warning: checkpoint does not match this query, processing from the start\n";
+            return {};
+        }
+
+        std::map<std::string, size_t> offsets;
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t length, device, inode, offset, prefix;
+            if (!get_pod(view, length) || length > view.size()) return {};
+            std::string file(view.substr(0, length));
+            view.remove_prefix(length);
+            if (!get_pod(view, device) || !get_pod(view, inode) || !get_pod(view, offset) || !get_pod(view, prefix)) return {};
+            if (std::find(files.begin(), files.end(), file) == files.end() || !unchanged(file, device, inode, offset, prefix)) {
+                std::cout << "Warning: " << file << " changed since the checkpoint, processing from the start\n";
+                return {};
+            }
+            offsets[file] = offset;
+        }
+        if (!load_observer_states(queries, view)) return {};
+        return offsets;
+    }
+
+    bool save(const std::map<std::string, size_t>& ends, const std::vector<Query>& queries) const {
+        std::string data(magic, sizeof(magic));
+        put_pod(data, tag);
+        put_pod(data, static_cast<uint64_t>(ends.size()));
+        for (const auto& [file, end] : ends) {
+            int fd = ::open(file.c_str(), O_RDONLY);
+            struct stat st{};
+            if (fd < 0 || ::fstat(fd, &st) != 0) {
+                if (fd >= 0) ::close(fd);
+                return false;
+            }
+            put_pod(data, static_cast<uint64_t>(file.size()));
+            data += file;
+            put_pod(data, static_cast<uint64_t>(st.st_dev));
+            put_pod(data, static_cast<uint64_t>(st.st_ino));
+            put_pod(data, static_cast<uint64_t>(end));
+            put_pod(data, sample_hash(fd, end));
+            ::close(fd);
+        }
+        if (!save_observer_states(queries, data)) return false;
+
+        std::string temp = path + ".tmp" + std::to_string(::getpid());
+        if (!std::ofstream(temp, std::ios::binary).write(data.data(), data.size())) return false;
+        std::error_code ec;
+        std::filesystem::rename(temp, path, ec);
+        return !ec;
+    }
+
+private:
+    static bool unchanged(const std::string& file, uint64_t device, uint64_t inode, uint64_t offset, uint64_t prefix) {
+        int fd = ::open(file.c_str(), O_RDONLY);
+        struct stat st{};
+        bool same = fd >= 0 && ::fstat(fd, &st) == 0 && uint64_t(st.st_dev) == device
+            && uint64_t(st.st_ino) == inode && uint64_t(st.st_size) >= offset && sample_hash(fd, offset) == prefix;
+        if (fd >= 0) ::close(fd);
+        return same;
+    }
+};
+
+std::vector<std::string> expand_inputs(const std::vector<std::string>& args) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> files;
+    for (const auto& arg : args) {
+        std::error_code ec;
+        if (fs::is_directory(arg, ec)) {
+            std::vector<std::string> found;
+            for (const auto& entry : fs::recursive_directory_iterator(arg, ec)) {
+                if (entry.is_regular_file()) found.push_back(entry.path().string());
+            }
+            std::sort(found.begin(), found.end());
+            files.insert(files.end(), found.begin(), found.end());
+        }
+        else if (arg.find_first_of("*?[") != std::string::npos) {
+            glob_t matches{};
+            if (glob(arg.c_str(), 0, nullptr, &matches) == 0) {
+                for (size_t i = 0; i < matches.gl_pathc; ++i) {
+                    files.push_back(matches.gl_pathv[i]);
+                }
+            }
+            else {
+                std::cout << "Error: No files match: " << arg << "\n";
+            }
+            globfree(&matches);
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+    return files;
+}
+
+// Parses "a,b,c"; `expected` of 0 accepts any non-empty list. Throws like
+// std::stoi on malformed input.
+std::vector<int> parse_int_list(const std::string& text, char separator, size_t expected) {
+    std::vector<int> values;
+    size_t from = 0;
+    while (from <= text.size()) {
+        size_t to = std::min(text.find(separator, from), text.size());
+        std::string item = text.substr(from, to - from);
+        size_t used = 0;
+        values.push_back(std::stoi(item, &used));
+        if (used != item.size()) throw std::invalid_argument("Trailing characters");
+        from = to + 1;
+    }
+    if (values.empty() || (expected && values.size() != expected)) {
+        throw std::invalid_argument("Wrong number of values");
+    }
+    return values;
+}
+
+void register_builtin_filters() {
+    FilterFactory::instance().register_filter("EVEN", [](const std::string&) {
+        return std::make_unique<EvenFilter>();
+        });
+
+    FilterFactory::instance().register_filter("ODD", [](const std::string&) {
+        return std::make_unique<OddFilter>();
+        });
+
+    FilterFactory::instance().register_filter("GT", [](const std::string& param) -> std::unique_ptr<INumberFilter> {
+        try {
+            if (param.empty()) throw std::invalid_argument("Missing value");
+            int n = std::stoi(param);
+            return std::make_unique<GTFilter>(n);
+        }
+        catch (...) {
+            std::cout << "Error: GT filter requires a numeric value, e.g., GT5\n";
+            return nullptr;
+        }
+        });
+
+    FilterFactory::instance().register_filter("LT", [](const std::string& param) -> std::unique_ptr<INumberFilter> {
+        try {
+            if (param.empty()) throw std::invalid_argument("Missing value");
+            return std::make_unique<LTFilter>(parse_int_list(param, ',', 1)[0]);
+        }
+        catch (...) {
+            std::cout << "Error: LT filter requires a numeric value, e.g., LT5\n";
+            return nullptr;
+        }
+        });
+
+    FilterFactory::instance().register_filter("BETWEEN", [](const std::string& param) -> std::unique_ptr<INumberFilter> {
+        try {
+            auto bounds = parse_int_list(param, ',', 2);
+            if (bounds[0] > bounds[1]) throw std::invalid_argument("Empty range");
+            return std::make_unique<BetweenFilter>(bounds[0], bounds[1]);
+        }
+        catch (...) {
+            std::cout << "Error: BETWEEN filter requires two ordered values, e.g., BETWEEN1,10\n";
+            return nullptr;
+        }
+        });
+
+    FilterFactory::instance().register_filter("IN", [](const std::string& param) -> std::unique_ptr<INumberFilter> {
+        try {
+            return std::make_unique<InSetFilter>(parse_int_list(param, ',', 0));
+        }
+        catch (...) {
+            std::cout << "Error: IN filter requires a list of values, e.g., IN1,5,9\n";
+            return nullptr;
+        }
+        });
+
+    FilterFactory::instance().register_filter("MOD", [](const std::string& param) -> std::unique_ptr<INumberFilter> {
+        try {
+            auto eq = param.find('=');
+            if (eq == std::string::npos) throw std::invalid_argument("Missing remainder");
+            int k = parse_int_list(param.substr(0, eq), ',', 1)[0];
+            int r = parse_int_list(param.substr(eq + 1), ',', 1)[0];
+            if (k == 0) throw std::invalid_argument("Zero divisor");
+            return std::make_unique<ModFilter>(k, r);
+        }
+        catch (...) {
+            std::cout << "Error: MOD filter requires a divisor and remainder, e.g., MOD3=1\n";
+            return nullptr;
+        }
+        });
+}
+
+struct GeneratorOptions {
+    std::string path;
+    size_t count = 1000000;
+    size_t bytes = 0;
+    std::string distribution = "uniform";
+    int min = 0;
+    int max = 1000000;
+    double selectivity = -1;
+    std::string whitespace = "newline";
+    bool sorted = false;
+    unsigned seed = 42;
+};
+
+// Writes a synthetic input file. `bytes`, when set, overrides `count`;
+// `selectivity` is the fraction of values forced even (so it is also the
+// pass rate of EVEN).
+bool generate_numbers(const GeneratorOptions& options) {
+    int fd = ::open(options.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cout << "Error: Cannot create file: " << options.path << "\n";
+        return false;
+    }
+
+    std::mt19937 rng(options.seed);
+    std::uniform_int_distribution<int> uniform(options.min, options.max);
+    std::normal_distribution<double> normal((options.min + double(options.max)) / 2,
+        (double(options.max) - options.min) / 6);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    auto next_value = [&] {
+        double v;
+        if (options.distribution == "normal") v = normal(rng);
+        else if (options.distribution == "skewed") v = options.min + (double(options.max) - options.min) * std::pow(unit(rng), 4);
+        else return uniform(rng);
+        return static_cast<int>(std::clamp(v, double(options.min), double(options.max)));
+    };
+    auto adjust_parity = [&](int v) {
+        if (options.selectivity < 0) return v;
+        bool want_even = unit(rng) < options.selectivity;
+        // A range of a single value cannot change parity, so it is kept.
+        if ((v % 2 == 0) != want_even) {
+            if (v < options.max) ++v;
+            else if (v > options.min) --v;
+        }
+        return v;
+    };
+    auto separator = [&] {
+        if (options.whitespace == "space") return ' ';
+        if (options.whitespace == "mixed") return " \n\t"[rng() % 3];
+        return '\n';
+    };
+
+    BufferedWriter out(fd);
+    if (options.sorted || options.bytes > 0) {
+        std::vector<int> values;
+        size_t written = 0;
+        char digits[16];
+        while (options.bytes > 0 ? written < options.bytes : values.size() < options.count) {
+            values.push_back(adjust_parity(next_value()));
+            written += std::to_chars(digits, digits + sizeof(digits), values.back()).ptr - digits + 1;
+        }
+        if (options.sorted) std::sort(values.begin(), values.end());
+        for (int v : values) out.put_line("", v, separator());
+    }
+    else {
+        for (size_t i = 0; i < options.count; ++i) {
+            out.put_line("", adjust_parity(next_value()), separator());
+        }
+    }
+    out.flush();
+    ::close(fd);
+    return true;
+}
+
+// Hides where a pointer came from, so calls through it stay virtual and the
+// work behind them cannot be folded away.
+template <typename T>
+T* opaque(T* p) {
+    asm volatile("" : "+r"(p));
+    return p;
+}
+
+template <typename F>
+double best_time(int repetitions, F&& body) {
+    double best = 1e300;
+    for (int i = 0; i < repetitions; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+// User-space hardware counters of the calling thread and the threads it
+// starts while counting, via perf_event_open. Each event is opened on its own
+// so it can be inherited; if the PMU multiplexes them, readings are scaled by
+// the fraction of time the event was actually counting.
+class PerfCounters {
+    static constexpr std::pair<uint32_t, uint64_t> events[] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    };
+
+    std::vector<int> fds;
+    std::string error;
+
+public:
+    struct Sample {
+        double cycles = 0;
+        double instructions = 0;
+        double branch_misses = 0;
+        double cache_misses = 0;
+
+        double ipc() const {
+            return cycles > 0 ? instructions / cycles : 0;
+        }
+    };
+
+    PerfCounters() {
+        for (const auto& [type, config] : events) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+            if (fd < 0) {
+                error = std::strerror(errno);
+                close_all();
+                return;
+            }
+            fds.push_back(fd);
+        }
+    }
+
+    ~PerfCounters() {
+        close_all();
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const {
+        return !fds.empty();
+    }
+
+    const std::string& why_unavailable() const {
+        return error;
+    }
+
+    void start() {
+        for (int fd : fds) {
+            ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    Sample stop() {
+        for (int fd : fds) ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        double values[std::size(events)] = {};
+        for (size_t i = 0; i < fds.size(); ++i) {
+            uint64_t data[3];
+            if (::read(fds[i], data, sizeof(data)) == sizeof(data) && data[2] > 0) {
+                values[i] = static_cast<double>(data[0]) * data[1] / data[2];
+            }
+        }
+        return { values[0], values[1], values[2], values[3] };
+    }
+
+private:
+    void close_all() {
+        for (int fd : fds) ::close(fd);
+        fds.clear();
+    }
+};
+
+// Measures raw reading, parsing, each reader, filter and observer in isolation
+// plus end-to-end runs, reporting MB/s (relative to the input file size) and
+// numbers/s as JSON. With `perf`, one extra run of each benchmark is counted
+// with PerfCounters and the counts are reported next to the throughput.
+int run_benchmarks(const std::string& file, const std::string& json_path, int repetitions, bool perf = false) {
+    FileNumberReader file_reader;
+    auto numbers = file_reader.read_numbers(file);
+    std::error_code ec;
+    double bytes = static_cast<double>(std::filesystem::file_size(file, ec));
+    if (ec || numbers.empty()) {
+        std::cout << "Error: Benchmark input is empty or missing: " << file << "\n";
+        return 1;
+    }
+    int null_fd = ::open("/dev/null", O_WRONLY);
+    std::ostringstream discard;
+
+    std::unique_ptr<PerfCounters> counters;
+    if (perf) {
+        counters = std::make_unique<PerfCounters>();
+        if (!counters->available()) {
+            std::cerr << "Warning: hardware counters unavailable (perf_event_open: " << counters->why_unavailable() << ")\n";
+            counters.reset();
+        }
+    }
+
+    struct Result {
+        std::string name;
+        double seconds;
+        std::optional<PerfCounters::Sample> sample;
+    };
+    std::vector<Result> results;
+    auto measure = [&](const std::string& name, auto&& body) {
+        results.push_back({ name, best_time(repetitions, body), std::nullopt });
+        if (counters) {
+            counters->start();
+            body();
+            results.back().sample = counters->stop();
+        }
+    };
+
+    std::string text;
+    {
+        std::ifstream in(file, std::ios::binary);
+        text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    measure("read/read(2)", [&] {
+        int fd = open_input(file);
+        std::vector<char> buffer(1 << 20);
+        while (::read(fd, buffer.data(), buffer.size()) > 0) {}
+        ::close(fd);
+        });
+    if (file_reader.reads_text(file)) {
+        measure("parse/parse_numbers", [&] {
+            std::vector<int> parsed;
+            parsed.reserve(numbers.size());
+            parse_numbers(text.data(), text.data() + text.size(), true, parsed);
+            if (parsed.size() != numbers.size()) std::cout << "Warning: parse mismatch\n";
+            });
+    }
+
+    ReadAheadFileReader read_ahead_reader;
+    std::vector<std::pair<std::string, INumberReader*>> readers = {
+        { "reader/FileNumberReader", &file_reader },
+        { "reader/ReadAheadFileReader", &read_ahead_reader },
+    };
+    for (auto& entry : readers) {
+        measure(entry.first, [&] {
+            size_t total = 0;
+            entry.second->read_batches(file, [&](const std::vector<int>& batch) { total += batch.size(); });
+            if (total != numbers.size()) std::cout << "Warning: reader mismatch in " << entry.first << "\n";
+            });
+    }
+
+    // Every filter kind, with thresholds at the input's quartiles so each
+    // passes a known share. IN is measured with a small contiguous set, which
+    // takes the bitset path, and with values sampled across the input, which
+    // take the hash path unless the input range is narrow.
+    std::vector<int> sorted = numbers;
+    std::sort(sorted.begin(), sorted.end());
+    auto quantile = [&](size_t percent) { return std::to_string(sorted[(sorted.size() - 1) * percent / 100]); };
+    long long median = sorted[(sorted.size() - 1) / 2];
+    std::string dense_set = "IN" + quantile(50);
+    for (int i = 1; i < 64; ++i) dense_set += "," + std::to_string(median + i);
+    std::string sampled_set = "IN";
+    for (size_t i = 0; i < 1024; ++i) {
+        sampled_set += (i ? "," : "") + std::to_string(sorted[(sorted.size() - 1) * i / 1023]);
+    }
+    std::vector<std::pair<std::string, std::string>> filters = {
+        { "EVEN", "EVEN" },
+        { "ODD", "ODD" },
+        { "GT" + quantile(50), "GT" + quantile(50) },
+        { "LT" + quantile(50), "LT" + quantile(50) },
+        { "BETWEEN" + quantile(25) + "," + quantile(75), "BETWEEN" + quantile(25) + "," + quantile(75) },
+        { "MOD3=1", "MOD3=1" },
+        { "IN/contiguous64", dense_set },
+        { "IN/sampled1024", sampled_set },
+    };
+    for (const auto& [name, spec] : filters) {
+        auto filter = FilterFactory::instance().create(spec);
+        if (!filter) continue;
+        measure("filter/" + name, [&] {
+            size_t kept = 0;
+            for (int n : numbers) kept += filter->keep(n);
+            discard << kept;
+            });
+        measure("filter/" + name + "/select", [&] {
+            std::vector<uint32_t> selection(4096);
+            size_t kept = 0;
+            for (size_t i = 0; i < numbers.size(); i += selection.size()) {
+                size_t count = std::min(selection.size(), numbers.size() - i);
+                kept += filter->select(numbers.data() + i, count, selection.data());
+            }
+            discard << kept;
+            });
+    }
+
+    // Observers are called through an opaque pointer, one number at a time
+    // and in batches, as NumberProcessor calls them.
+    auto measure_observer = [&](const std::string& name, auto make) {
+        measure("observer/" + name, [&] {
+            auto owned = make();
+            INumberObserver* observer = opaque<INumberObserver>(owned.get());
+            for (int n : numbers) observer->on_number(n);
+            observer->on_finished();
+            });
+        measure("observer/" + name + "/batch", [&] {
+            auto owned = make();
+            INumberObserver* observer = opaque<INumberObserver>(owned.get());
+            for (size_t i = 0; i < numbers.size(); i += 4096) {
+                observer->on_batch(numbers.data() + i, identity_selection(), std::min<size_t>(4096, numbers.size() - i));
+            }
+            observer->on_finished();
+            });
+    };
+    measure_observer("PrintObserver", [&] { return std::make_unique<PrintObserver>(false, null_fd); });
+    measure_observer("CountObserver", [&] { return std::make_unique<CountObserver>(discard); });
+
+    unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned jobs : { 1u, hardware }) {
+        auto filter = FilterFactory::instance().create("EVEN");
+        measure("end_to_end/EVEN/j" + std::to_string(jobs), [&] {
+            PrintObserver printer(false, null_fd);
+            CountObserver counter(discard);
+            NumberProcessor processor(file_reader, *filter, { &printer, &counter });
+            processor.run({ file }, jobs);
+            });
+        if (hardware == 1) break;
+    }
+    ::close(null_fd);
+
+    std::ostringstream json;
+    json << "{\n  \"file\": \"" << file << "\",\n  \"bytes\": " << static_cast<size_t>(bytes)
+        << ",\n  \"numbers\": " << numbers.size() << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& [name, seconds, sample] = results[i];
+        json << "    { \"name\": \"" << name << "\", \"seconds\": " << seconds
+            << ", \"mb_per_s\": " << bytes / seconds / 1e6
+            << ", \"numbers_per_s\": " << numbers.size() / seconds;
+        if (sample) {
+            json << ", \"cycles\": " << static_cast<uint64_t>(sample->cycles)
+                << ", \"instructions\": " << static_cast<uint64_t>(sample->instructions)
+                << ", \"ipc\": " << sample->ipc()
+                << ", \"branch_misses\": " << static_cast<uint64_t>(sample->branch_misses)
+                << ", \"cache_misses\": " << static_cast<uint64_t>(sample->cache_misses)
+                << ", \"cycles_per_number\": " << sample->cycles / numbers.size();
+        }
+        json << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n}\n";
+
+    if (json_path.empty()) {
+        std::cout << json.str();
+    }
+    else {
+        std::ofstream(json_path) << json.str();
+    }
+    return 0;
+}
+
+// Keeps parsed files in memory, least recently used first out, within a byte
+// budget. An entry is reused only while the file's device, inode, size and
+// mtime are unchanged, so edited files are parsed again on their next use.
+class ParsedFileCache {
+    struct Entry {
+        std::string path;
+        dev_t device;
+        ino_t inode;
+        off_t size;
+        timespec mtime;
+        std::shared_ptr<const std::vector<int>> numbers;
+    };
+
+    size_t budget;
+    size_t used = 0;
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::mutex m;
+
+public:
+    explicit ParsedFileCache(size_t budget) : budget(budget) {
+    }
+
+    std::shared_ptr<const std::vector<int>> get(const std::string& path) {
+        struct stat st{};
+        if (::stat(path.c_str(), &st) != 0) return nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            auto it = index.find(path);
+            if (it != index.end()) {
+                const Entry& entry = *it->second;
+                if (entry.device == st.st_dev && entry.inode == st.st_ino && entry.size == st.st_size
+                    && entry.mtime.tv_sec == st.st_mtim.tv_sec && entry.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                    entries.splice(entries.begin(), entries, it->second);
+                    return entry.numbers;
+                }
+                erase(it->second);
+            }
+        }
+
+        FileNumberReader reader;
+        auto numbers = std::make_shared<const std::vector<int>>(reader.read_numbers(path));
+        size_t bytes = numbers->size() * sizeof(int);
+        if (bytes > budget) return numbers;
+
+        std::lock_guard<std::mutex> lock(m);
+        auto it = index.find(path);
+        if (it != index.end()) erase(it->second);
+        while (used + bytes > budget) erase(std::prev(entries.end()));
+        entries.push_front({ path, st.st_dev, st.st_ino, st.st_size, st.st_mtim, numbers });
+        index[path] = entries.begin();
+        used += bytes;
+        return numbers;
+    }
+
+private:
+    void erase(std::list<Entry>::iterator it) {
+        used -= it->numbers->size() * sizeof(int);
+        index.erase(it->path);
+        entries.erase(it);
+    }
+};
+
+// Serves files out of a ParsedFileCache in batches.
+class CachedNumberReader : public INumberReader {
+    static constexpr size_t batch_numbers = 1 << 16;
+    ParsedFileCache& cache;
+
+public:
+    explicit CachedNumberReader(ParsedFileCache& cache) : cache(cache) {
+    }
+
+    std::vector<int> read_numbers(const std::string& filename) override {
+        auto numbers = cache.get(filename);
+        return numbers ? *numbers : std::vector<int>();
+    }
+
+    void read_batches(const std::string& filename, const BatchSink& sink) override {
+        auto numbers = cache.get(filename);
+        if (!numbers) return;
+        std::vector<int> batch;
+        for (size_t i = 0; i < numbers->size() && !cancelled(); i += batch_numbers) {
+            batch.assign(numbers->begin() + i, numbers->begin() + std::min(numbers->size(), i + batch_numbers));
+            sink(batch);
+        }
+    }
+};
+
+// Answers one `<FILTER> <FILE>` request per line on a local socket with the
+// passing numbers, one per line, followed by the total. Filters are registered
+// once and parsed files stay cached between requests and connections.
+int run_server(const std::string& socket_path, size_t cache_budget) {
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (listener < 0 || socket_path.size() >= sizeof(address.sun_path)) {
+        std::cout << "Error: Cannot create socket: " << socket_path << "\n";
+        if (listener >= 0) ::close(listener);
+        return 1;
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    ::unlink(socket_path.c_str());
+    if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listener, 64) != 0) {
+        std::cout << "Error: Cannot listen on socket: " << socket_path << "\n";
+        ::close(listener);
+        return 1;
+    }
+
+    std::signal(SIGINT, [](int) { stop_requested = 1; });
+    std::signal(SIGTERM, [](int) { stop_requested = 1; });
+    std::signal(SIGPIPE, SIG_IGN);
+    register_builtin_filters();
+    ParsedFileCache cache(cache_budget);
+    std::cout << "Listening on " << socket_path << "\n" << std::flush;
+
+    auto answer = [&cache](int client, const std::string& request) {
+        auto split = request.find_last_of(" \t");
+        if (split == std::string::npos) {
+            BufferedWriter(client).put("Error: Expected <FILTER> <FILE>\n");
+            return;
+        }
+        std::string name = request.substr(0, split);
+        std::string file = request.substr(split + 1);
+        auto filter = FilterFactory::instance().create(name);
+        if (!filter) {
+            BufferedWriter(client).put("Error: Unknown filter: " + name + "\n");
+            return;
+        }
+        struct stat st{};
+        if (::stat(file.c_str(), &st) != 0) {
+            BufferedWriter(client).put("Error: File not found: " + file + "\n");
+            return;
+        }
+        std::ostringstream total;
+        CachedNumberReader reader(cache);
+        PrintObserver print(true, client);
+        CountObserver count(total);
+        NumberProcessor processor(reader, *filter, { &print, &count });
+        processor.run(file);
+        BufferedWriter(client).put(total.str());
+    };
+
+    // Each client gets a thread; finished ones are joined as new clients
+    // arrive, and on shutdown the rest are woken by shutdown(2) and joined
+    // before `answer` and `cache` go away.
+    struct Connection {
+        int fd;
+        std::atomic<bool> closed{ false };
+        std::thread thread;
+    };
+    std::list<Connection> connections;
+    auto reap = [&connections](bool all) {
+        for (auto it = connections.begin(); it != connections.end();) {
+            if (!all && !it->closed) {
+                ++it;
+                continue;
+            }
+            if (all) ::shutdown(it->fd, SHUT_RDWR);
+            it->thread.join();
+            ::close(it->fd);
+            it = connections.erase(it);
+        }
+    };
+
+    while (!stop_requested) {
+        pollfd pfd{ listener, POLLIN, 0 };
+        reap(false);
+        if (::poll(&pfd, 1, 1000) <= 0) continue;
+        int client = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) continue;
+        Connection& connection = connections.emplace_back();
+        connection.fd = client;
+        connection.thread = std::thread([client, &answer, &connection] {
+            std::string pending;
+            char chunk[4096];
+            ssize_t got;
+            while ((got = ::read(client, chunk, sizeof(chunk))) > 0) {
+                pending.append(chunk, got);
+                size_t newline;
+                while ((newline = pending.find('\n')) != std::string::npos) {
+                    std::string request = pending.substr(0, newline);
+                    pending.erase(0, newline + 1);
+                    while (!request.empty() && std::isspace(static_cast<unsigned char>(request.back()))) request.pop_back();
+                    if (!request.empty()) answer(client, request);
+                }
+            }
+            ::shutdown(client, SHUT_RDWR);
+            connection.closed = true;
+            });
+    }
+
+    reap(true);
+    ::close(listener);
+    ::unlink(socket_path.c_str());
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    bool follow = false;
+    bool pipeline = false;
+    bool lazy = false;
+    bool bare = false;
+    std::string output;
+    auto output_format = FileWriterObserver::Format::TEXT;
+    bool output_mmap = false;
+    std::string partition;
+    bool sort_output = false;
+    bool unique_output = false;
+    size_t sort_memory = 256;
+    auto window_kind = WindowObserver::Kind::SLIDING;
+    size_t window_size = 0;
+    size_t window_every = 0;
+    std::string group_by;
+    size_t limit = 0;
+    bool exists = false;
+    bool quiet = false;
+    std::string result_cache;
+    std::string checkpoint;
+    size_t csv_column = 0;
+    char csv_delimiter = ',';
+    bool csv_header = false;
+    size_t read_ahead = 0;
+    GeneratorOptions generator;
+    std::string bench_file;
+    std::string bench_json;
+    bool bench_perf = false;
+    std::string convert;
+    std::string serve;
+    size_t cache_memory = 1024;
+    bool show_stats = false;
+    std::string stats_json;
+    int repetitions = 3;
+    std::vector<std::string> query_names;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&](const char* name) -> const char* {
+            return arg.starts_with(name) ? arg.c_str() + std::strlen(name) : nullptr;
+        };
+        if (auto v = value("--generate=")) generator.path = v;
+        else if (auto v = value("--count=")) generator.count = std::strtoull(v, nullptr, 10);
+        else if (auto v = value("--bytes=")) generator.bytes = std::strtoull(v, nullptr, 10);
+        else if (auto v = value("--dist=")) generator.distribution = v;
+        else if (auto v = value("--min=")) generator.min = std::atoi(v);
+        else if (auto v = value("--max=")) generator.max = std::atoi(v);
+        else if (auto v = value("--selectivity=")) generator.selectivity = std::atof(v);
+        else if (auto v = value("--ws=")) generator.whitespace = v;
+        else if (auto v = value("--seed=")) generator.seed = std::atoi(v);
+        else if (arg == "--sorted") generator.sorted = true;
+        else if (auto v = value("--bench=")) bench_file = v;
+        else if (auto v = value("--bench-json=")) bench_json = v;
+        else if (arg == "--bench-perf") bench_perf = true;
+        else if (auto v = value("--repeat=")) repetitions = std::max(1, std::atoi(v));
+        else if (auto v = value("--convert=")) convert = v;
+        else if (auto v = value("--serve=")) serve = v;
+        else if (auto v = value("--cache-memory=")) cache_memory = std::strtoull(v, nullptr, 10);
+        else if (auto v = value("--query=")) query_names.push_back(v);
+        else if (arg == "-q" && i + 1 < argc) query_names.push_back(argv[++i]);
+        else if (auto v = value("--output=")) output = v;
+        else if (arg == "--output-format=binary") output_format = FileWriterObserver::Format::BINARY;
+        else if (arg == "--output-format=text") output_format = FileWriterObserver::Format::TEXT;
+        else if (arg == "--output-mmap") output_mmap = true;
+        else if (auto v = value("--partition=")) partition = v;
+        else if (arg == "--sort") sort_output = true;
+        else if (arg == "--unique") unique_output = true;
+        else if (auto v = value("--sort-memory=")) sort_memory = std::strtoull(v, nullptr, 10);
+        else if (auto v = value("--window=")) {
+            window_kind = WindowObserver::Kind::SLIDING;
+            window_size = std::strtoull(v, nullptr, 10);
+        }
+        else if (auto v = value("--tumbling=")) {
+            window_kind = WindowObserver::Kind::TUMBLING;
+            window_size = std::strtoull(v, nullptr, 10);
+        }
+        else if (auto v = value("--window-every=")) window_every = std::strtoull(v, nullptr, 10);
+        else if (auto v = value("--group-by=")) group_by = v;
+        else if (auto v = value("--limit=")) limit = std::strtoull(v, nullptr, 10);
+        else if (arg == "--exists") exists = true;
+        else if (arg == "--quiet") quiet = true;
+        else if (auto v = value("--result-cache=")) result_cache = v;
+        else if (auto v = value("--checkpoint=")) checkpoint = v;
+        else if (auto v = value("--column=")) csv_column = std::strtoull(v, nullptr, 10);
+        else if (auto v = value("--delimiter=")) csv_delimiter = std::string(v) == "tab" ? '\t' : *v;
+        else if (arg == "--header") csv_header = true;
+        else if (arg == "--stats") show_stats = true;
+        else if (auto v = value("--stats-json=")) stats_json = v;
+        else if (arg == "--follow") {
+            follow = true;
+        }
+        else if (arg == "--bare") {
+            bare = true;
+        }
+        else if (arg == "--pipeline") {
+            pipeline = true;
+        }
+        else if (arg == "--lazy") {
+            lazy = true;
+        }
+        else if (arg == "--read-ahead") {
+            read_ahead = 4;
+        }
+        else if (arg.starts_with("--read-ahead=")) {
+            read_ahead = std::max(2, std::atoi(arg.c_str() + 13));
+        }
+        else if (arg.starts_with("--jobs=")) {
+            jobs = std::max(1, std::atoi(arg.c_str() + 7));
+        }
+        else if (arg == "-j" && i + 1 < argc) {
+            jobs = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg.starts_with("-j") && arg.size() > 2) {
+            jobs = std::max(1, std::atoi(arg.c_str() + 2));
+        }
+        else {
+            args.push_back(arg);
+        }
+    }
+
+    if (!generator.path.empty()) {
+        if (generator.min > generator.max) {
+            std::cout << "Error: --min must not be greater than --max\n";
+            return 1;
+        }
+        return generate_numbers(generator) ? 0 : 1;
+    }
+    if (!convert.empty()) {
+        std::map<std::string, Encoding> encodings = {
+            { "delta", Encoding::DELTA_VARINT },
+            { "for", Encoding::FRAME_OF_REFERENCE },
+            { "bitpack", Encoding::BIT_PACKED },
+        };
+        if (!encodings.count(convert) || args.size() != 2) {
+            std::cout << "Usage: ./number_pipeline --convert=delta|for|bitpack <INPUT> <OUTPUT>\n";
+            return 1;
+        }
+        return convert_to_compressed(args[0], args[1], encodings[convert]) ? 0 : 1;
+    }
+    if (!serve.empty()) {
+        return run_server(serve, cache_memory << 20);
+    }
+    if (!bench_file.empty()) {
+        register_builtin_filters();
+        return run_benchmarks(bench_file, bench_json, repetitions, bench_perf);
+    }
+
+    if (args.size() < (query_names.empty() ? 2u : 1u)) {
+        std::cout << "Usage: ./number_pipeline [-j N] [--follow] [--read-ahead[=K]] [--pipeline|--lazy] [--column=N [--delimiter=C|tab] [--header]] [--bare] [--output=<FILE> [--output-format=text|binary] [--output-mmap|--partition=hash:N|range:N[:MIN:MAX]]] [--sort] [--unique] [--sort-memory=MB]\n";
+        std::cout << "                         [--window=N|--tumbling=N [--window-every=K]] [--group-by=div:W|mod:K|high:B]\n";
+        std::cout << "                         [--limit=N] [--exists] [--quiet] [--result-cache=<DIR>] [--checkpoint=<FILE>] [--stats] [--stats-json=<OUT>] <FILTER> <FILE|DIR|GLOB|->...\n";
+        std::cout << "       ./number_pipeline [options] -q <FILTER> [-q <FILTER>]... <FILE|DIR|GLOB|->...\n";
+        std::cout << "       ./number_pipeline --generate=<FILE> [--count=N|--bytes=N] [--dist=uniform|normal|skewed]\n";
+        std::cout << "                         [--min=A] [--max=B] [--selectivity=P] [--ws=newline|space|mixed] [--sorted] [--seed=S]\n";
+        std::cout << "       ./number_pipeline --convert=delta|for|bitpack <INPUT> <OUTPUT>\n";
+        std::cout << "       ./number_pipeline --serve=<SOCKET> [--cache-memory=MB]\n";
+        std::cout << "       ./number_pipeline --bench=<FILE> [--bench-json=<OUT>] [--repeat=N] [--bench-perf]\n";
+        std::cout << "Example filters: EVEN, ODD, GT5, LT5, BETWEEN1,10, IN1,5,9, MOD3=1, EVEN&GT5\n";
+        return 1;
+    }
+
+    if (query_names.empty()) {
+        query_names.push_back(args[0]);
+        args.erase(args.begin());
+    }
+    auto files = expand_inputs(args);
+    if (files.empty()) return 1;
+    if (follow && csv_column) {
+        std::cout << "Error: --follow cannot be combined with --column\n";
+        return 1;
+    }
+    if (follow && (files.size() != 1 || files[0] == "-")) {
+        std::cout << "Error: --follow requires exactly one regular file\n";
+        return 1;
+    }
+    if (exists && (!group_by.empty() || window_size)) {
+        std::cout << "Error: --exists cannot be combined with --group-by or --window\n";
+        return 1;
+    }
+
+    register_builtin_filters();
+    bool labelled = query_names.size() > 1;
+    std::vector<std::unique_ptr<INumberFilter>> filters;
+    std::vector<std::unique_ptr<INumberObserver>> observers;
+    std::vector<Query> queries;
+    for (const auto& name : query_names) {
+        auto filter = FilterFactory::instance().create(name);
+        if (!filter) return 1;
+        std::string label = labelled ? name : "";
+        Query query{ filter.get(), {}, limit };
+        auto add = [&](std::unique_ptr<INumberObserver> obs) {
+            query.observers.push_back(obs.get());
+            observers.push_back(std::move(obs));
+        };
+
+        std::unique_ptr<INumberObserver> results;
+        if (exists) {
+            results = std::make_unique<ExistsObserver>(std::cout, label);
+        }
+        else if (output.empty()) {
+            results = std::make_unique<PrintObserver>(bare, STDOUT_FILENO, label);
+        }
+        else if (!partition.empty()) {
+            std::string prefix = labelled ? output + "." + std::to_string(queries.size()) : output;
+            std::vector<std::string> fields;
+            std::stringstream spec(partition);
+            for (std::string field; std::getline(spec, field, ':');) fields.push_back(field);
+            size_t count = fields.size() > 1 ? std::strtoull(fields[1].c_str(), nullptr, 10) : 0;
+            bool range = fields[0] == "range" && (fields.size() == 2 || fields.size() == 4);
+            if ((!range && (fields[0] != "hash" || fields.size() != 2)) || count == 0 || count > 4096) {
+                std::cout << "Error: --partition expects hash:N or range:N[:MIN:MAX] with 1 <= N <= 4096\n";
+                return 1;
+            }
+            int64_t lo = fields.size() == 4 ? std::atoll(fields[2].c_str()) : std::numeric_limits<int>::min();
+            int64_t hi = fields.size() == 4 ? std::atoll(fields[3].c_str()) : std::numeric_limits<int>::max();
+            auto writer = std::make_unique<PartitionedWriterObserver>(prefix, count,
+                range ? PartitionedWriterObserver::Scheme::RANGE : PartitionedWriterObserver::Scheme::HASH,
+                output_format, lo, std::max(lo, hi));
+            if (!writer->valid()) return 1;
+            results = std::move(writer);
+        }
+        else {
+            std::string path = labelled ? output + "." + std::to_string(queries.size()) : output;
+            auto writer = std::make_unique<FileWriterObserver>(path, output_format, output_mmap);
+            if (!writer->valid()) return 1;
+            results = std::move(writer);
+        }
+        if (!exists && (sort_output || unique_output)) {
+            results = std::make_unique<SortObserver>(std::move(results), unique_output, sort_memory << 20);
+        }
+        if (!exists && !result_cache.empty() && checkpoint.empty()) {
+            results = std::make_unique<RecordingObserver>(std::move(results));
+        }
+        if (!quiet || exists) add(std::move(results));
+        // An EXISTS query stops at its first match, so a count would be partial.
+        if (!exists) add(std::make_unique<CountObserver>(std::cout, label));
+        if (!group_by.empty()) {
+            static const std::map<std::string, GroupByObserver::Key> keys = {
+                { "div", GroupByObserver::Key::DIV },
+                { "mod", GroupByObserver::Key::MOD },
+                { "high", GroupByObserver::Key::HIGH },
+            };
+            auto colon = group_by.find(':');
+            auto key = keys.find(group_by.substr(0, colon));
+            long long param = colon == std::string::npos ? 0 : std::atoll(group_by.c_str() + colon + 1);
+            if (key == keys.end() || param <= 0) {
+                std::cout << "Error: --group-by expects div:W, mod:K or high:B\n";
+                return 1;
+            }
+            add(std::make_unique<GroupByObserver>(key->second, param, std::cout, label));
+        }
+        if (window_size) {
+            add(std::make_unique<WindowObserver>(window_kind, window_size, window_every, std::cout, label));
+        }
+        queries.push_back(std::move(query));
+        filters.push_back(std::move(filter));
+    }
+
+    FileNumberReader file_reader;
+    FollowFileReader follow_reader;
+    ReadAheadFileReader read_ahead_reader(read_ahead);
+    DelimitedNumberReader delimited_reader(csv_delimiter, csv_column - 1, csv_header);
+    INumberReader& reader = csv_column ? static_cast<INumberReader&>(delimited_reader)
+        : follow ? static_cast<INumberReader&>(follow_reader)
+        : read_ahead ? static_cast<INumberReader&>(read_ahead_reader)
+        : file_reader;
+    if (follow) {
+        std::signal(SIGINT, [](int) { stop_requested = 1; });
+        std::signal(SIGTERM, [](int) { stop_requested = 1; });
+    }
+
+    NumberProcessor processor(reader, queries);
+    processor.set_incremental(follow);
+    processor.set_pipelined(pipeline);
+    processor.set_lazy(lazy && !follow);
+    PipelineStats stats;
+    if (show_stats || !stats_json.empty()) processor.set_stats(&stats);
+    std::ostringstream tag;
+    for (const auto& name : query_names) tag << normalize_filter(name) << ";";
+    tag << "limit=" << limit << ";exists=" << exists << ";quiet=" << quiet << ";bare=" << bare
+        << ";output=" << output << ";partition=" << partition << ";format=" << int(output_format) << ";sort=" << sort_output
+        << ";unique=" << unique_output << ";group-by=" << group_by << ";window=" << window_size
+        << ";column=" << csv_column << ";delimiter=" << csv_delimiter << ";header=" << csv_header;
+
+    if (!checkpoint.empty()) {
+        bool text = std::all_of(files.begin(), files.end(), [&](const std::string& file) {
+            return reader.splittable(file);
+        });
+        if (follow || limit || pipeline || lazy) {
+            std::cout << "Error: --checkpoint cannot be combined with --follow, --limit, --pipeline or --lazy\n";
+            return 1;
+        }
+        if (read_ahead || csv_column) {
+            std::cout << "Error: --checkpoint cannot be combined with --read-ahead or --column\n";
+            return 1;
+        }
+        if (!text) {
+            std::cout << "Error: --checkpoint needs regular text files\n";
+            return 1;
+        }
+        // Only mergeable aggregates are kept, so the checkpoint stays small
+        // and earlier results are not printed again on resume.
+        if (!persistable(queries)) {
+            std::cout << "Error: --checkpoint keeps only counts and aggregates; use --quiet or --exists and no --window\n";
+            return 1;
+        }
+        Checkpoint saved(checkpoint, tag.str());
+        auto starts = saved.resume(files, queries);
+        std::map<std::string, size_t> ends;
+        for (const auto& file : files) {
+            ends[file] = std::max(complete_prefix(file), starts[file]);
+            processor.set_range(file, starts[file], ends[file]);
+        }
+        processor.run(files, jobs);
+        if (!saved.save(ends, queries)) {
+            std::cout << "Error: Cannot write checkpoint: " << checkpoint << "\n";
+            return 1;
+        }
+        if (show_stats) stats.print_summary(std::cout);
+        if (!stats_json.empty()) std::ofstream(stats_json) << stats.to_json();
+        return 0;
+    }
+
+    std::unique_ptr<ResultCache> cache;
+    if (!result_cache.empty() && !follow) {
+        cache = std::make_unique<ResultCache>(result_cache, files, tag.str());
+    }
+    if (cache && cache->load(queries)) {
+        for (const auto& query : queries) {
+            for (auto* obs : query.observers) obs->on_finished();
+        }
+        // Nothing was read or measured, so no stage timings are reported.
+        if (show_stats) std::cout << "Stats: result loaded from the result cache, no input was processed\n";
+        if (!stats_json.empty()) std::ofstream(stats_json) << "{ \"cached\": true }\n";
+        return 0;
+    }
 
-    NumberProcessor processor(reader, *filter, observers);
-    processor.run(file_name);
+    processor.run(files, jobs);
+    if (cache) cache->store(queries);
+    if (show_stats) stats.print_summary(std::cout);
+    if (!stats_json.empty()) std::ofstream(stats_json) << stats.to_json();
 
     return 0;
 }